@@ -30,7 +30,9 @@ int main(int argc, char* argv[]) {
     ClientArgParser arg_parser(argc, argv);
     arg_parser.logInfo();
 
-    ClientLogic logic(arg_parser.getPlayerId(), arg_parser.isAutoStrategy());
+    ClientLogic logic(arg_parser.getPlayerId(), arg_parser.isAutoStrategy(),
+                      arg_parser.isStateDeltaRequested(), arg_parser.getRoom(),
+                      arg_parser.getWindow());
     int sockfd = make_connection(logic, arg_parser);
 
     logic.start_threads_and_send_hello();
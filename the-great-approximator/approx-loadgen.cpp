@@ -0,0 +1,43 @@
+#include <sys/resource.h>
+
+#include "arg_parser.h"
+#include "err.h"
+#include "load_generator.h"
+
+namespace {
+
+// Every player needs a descriptor; the soft limit (often 1024) is raised as far as allowed.
+void raise_open_files_limit(int connections) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        syserr("getrlimit");
+    }
+    rlim_t needed = (rlim_t)connections + 16; // standard streams, epoll and some spare
+    if (limit.rlim_cur >= needed) {
+        return;
+    }
+
+    limit.rlim_cur = limit.rlim_max == RLIM_INFINITY || limit.rlim_max > needed
+                         ? needed
+                         : limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        syserr("setrlimit");
+    }
+    if (limit.rlim_cur < needed) {
+        error("open files limit %llu is too low for %d connections",
+              (unsigned long long)limit.rlim_cur, connections);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    LoadgenArgParser arg_parser(argc, argv);
+    arg_parser.logInfo();
+    raise_open_files_limit(arg_parser.getConnections());
+
+    LoadGenerator generator(arg_parser);
+    generator.run();
+    generator.print_report();
+    return 0;
+}
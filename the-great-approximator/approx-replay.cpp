@@ -0,0 +1,15 @@
+#include <cstdio>
+
+#include "arg_parser.h"
+#include "trace_replayer.h"
+
+int main(int argc, char* argv[]) {
+    ReplayArgParser arg_parser(argc, argv);
+    arg_parser.logInfo();
+
+    TraceReplayer replayer(arg_parser);
+    printf("Captured from: %s\n", replayer.getCommandLine().c_str());
+    replayer.run();
+    replayer.print_report();
+    return replayer.is_identical() ? 0 : 1;
+}
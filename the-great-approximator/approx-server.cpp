@@ -1,203 +1,49 @@
-#include <arpa/inet.h>
-#include <poll.h>
-#include <unistd.h>
+#include <pthread.h>
 
+#include <csignal>
+#include <cstdlib>
 #include <iomanip>
 #include <ios>
 #include <iostream>
-#include <map>
 #include <memory>
 #include <string>
-#include <thread> // server is not multithreaded; this is imported for `sleep_for` only
+#include <thread>
 #include <vector>
 
 #include "arg_parser.h"
 #include "constants.h"
-#include "msg_parser.h"
+#include "game_clock.h"
+#include "game_coordinator.h"
 #include "networking.h"
-#include "server_events.h"
-#include "server_logic.h"
+#include "server_log.h"
+#include "server_shard.h"
+#include "trace.h"
 
 namespace {
-std::map<int, std::string> client_buffers;
-constexpr size_t buffer_size = 65535;
-char buffer[buffer_size];
-std::vector<struct pollfd> poll_fds;
-} // namespace
-
-void disconnect_client(int client_fd, size_t& i, ServerLogic& server_logic,
-                       std::string player_id) {
-    std::cout << "Disconnecting " << player_id << std::endl;
-    server_logic.handle_client_disconnect(client_fd);
-    close(client_fd);
-    poll_fds.erase(poll_fds.begin() + i);
-    client_buffers.erase(client_fd);
-    i--; // adjust index after erasing
-}
-
-void handle_new_connection(int listening_fd, ServerLogic& server_logic,
-                           EventManager& event_manager) {
-    struct sockaddr_storage client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
 
-    int client_fd = accept_new_connection(listening_fd, &client_addr, &client_addr_len);
-    if (client_fd < 0) {
-        return;
-    }
+ServerLog* server_log_to_drain = nullptr;
 
-    // Get client IP and port
-    char ip_str[INET6_ADDRSTRLEN]; // enough for IPv4 and IPv6
-    int port;
-    if (client_addr.ss_family == AF_INET) {
-        struct sockaddr_in* ipv4 = (struct sockaddr_in*)&client_addr;
-        inet_ntop(AF_INET, &(ipv4->sin_addr), ip_str, INET_ADDRSTRLEN);
-        port = ntohs(ipv4->sin_port);
-    } else {
-        struct sockaddr_in6* ipv6 = (struct sockaddr_in6*)&client_addr;
-        inet_ntop(AF_INET6, &(ipv6->sin6_addr), ip_str, INET6_ADDRSTRLEN);
-        port = ntohs(ipv6->sin6_port);
+// fatal() and syserr() exit from any thread; the records logged before are written out.
+void drain_server_log() {
+    if (server_log_to_drain) {
+        server_log_to_drain->drain();
     }
-
-    // Initially we only want to read (HELLO) from client.
-    poll_fds.push_back({client_fd, POLLIN, 0});
-
-    server_logic.register_new_client(client_fd, ip_str, port);
-    client_buffers[client_fd] = "";
-
-    // Wait for hello message
-    event_manager.add_event(
-        [&server_logic, client_fd, ip_str, port]() {
-            if (!server_logic.validate_client(client_fd, ip_str, port)) {
-                return; // client disconnected
-            }
-
-            if (!server_logic.getPlayerInfo(client_fd).is_known) {
-                size_t i = 0;
-                for (const auto& pollfd : poll_fds) {
-                    if (pollfd.fd == client_fd) {
-                        break;
-                    }
-                    i++;
-                }
-                std::cout << "Did not receive hello from [" << ip_str << "]:" << port << "."
-                          << std::endl;
-                disconnect_client(client_fd, i, server_logic,
-                                  server_logic.getClientPlayerID(client_fd));
-            }
-        },
-        std::chrono::steady_clock::now() + std::chrono::seconds(constants::hello_wait_time));
 }
 
-// Returns whether the client is still connected
-bool handle_read_from_client(ServerLogic& server_logic, size_t& i) {
-    auto& pollfd = poll_fds[i];
-    ssize_t bytes_read = recv(pollfd.fd, buffer, buffer_size, 0);
-    const std::string player_id = server_logic.getClientPlayerID(pollfd.fd);
-
-    if (bytes_read < 0) {
-        error("error reading from client %s", player_id.c_str());
-        disconnect_client(pollfd.fd, i, server_logic, player_id);
-        return false;
-    } else if (bytes_read == 0) {
-        disconnect_client(pollfd.fd, i, server_logic, player_id);
-        return false;
-    }
-
-    // successful read from client
-    client_buffers[pollfd.fd].append(buffer, bytes_read);
-
-    size_t crlf_pos = client_buffers[pollfd.fd].find(constants::crlf);
-    while (crlf_pos != std::string::npos) {
-        std::string msg_str = client_buffers[pollfd.fd].substr(0, crlf_pos);
-        client_buffers[pollfd.fd].erase(0, crlf_pos + constants::crlf.size());
-        crlf_pos = client_buffers[pollfd.fd].find(constants::crlf);
-
-        std::unique_ptr<Message> msg = Message::createMessageWithCRLF(msg_str);
-        if (!msg || !server_logic.handle_client_message(pollfd.fd, std::move(msg))) {
-            error("bad message from [%s]:%d, %s: %s",
-                  server_logic.getClientIP(pollfd.fd).c_str(),
-                  server_logic.getClientPort(pollfd.fd), player_id.c_str(), msg_str.c_str());
-        }
-
-        if (!server_logic.getPlayerInfo(pollfd.fd).is_known) {
-            std::cout << "Client sent message before hello." << std::endl;
-            disconnect_client(pollfd.fd, i, server_logic, player_id);
-            break;
-        }
-
-        if (server_logic.is_stopping()) {
-            break;
-        }
-    }
-
-    return true;
-}
-
-// Returns whether the client is still connected
-bool handle_write_to_client(ServerLogic& server_logic, size_t& i) {
-    auto& pollfd = poll_fds[i];
-    const std::string player_id = server_logic.getClientPlayerID(pollfd.fd);
-
-    if (!server_logic.has_pending_messages(pollfd.fd)) {
-        pollfd.events &= ~POLLOUT; // no need to listen for write events
-        return true;
-    }
-
-    std::string msg_str = server_logic.take_next_message_str(pollfd.fd);
-    if (msg_str.empty()) {
-        return true;
-    }
-
-    ssize_t bytes_written = send(pollfd.fd, msg_str.c_str(), msg_str.size(), 0);
-
-    if (bytes_written < 0) {
-        error("error writing to client %s", player_id.c_str());
-        disconnect_client(pollfd.fd, i, server_logic, player_id);
-        return false;
-    } else if (bytes_written == 0) {
-        disconnect_client(pollfd.fd, i, server_logic, player_id);
-        return false;
-    }
-
-    // Successful write to client.
-    std::string msg_rest = msg_str.substr(bytes_written);
-    if (!msg_rest.empty()) {
-        server_logic.append_message_front(pollfd.fd, msg_rest);
+// Runs in a thread of its own, the signals are blocked in all the others. Writes out the
+// log and terminates the server by the signal, like its default action would.
+void handle_termination_signals(sigset_t signals) {
+    int signal_number;
+    if (sigwait(&signals, &signal_number) != 0) {
+        return;
     }
-
-    return true;
+    drain_server_log();
+    signal(signal_number, SIG_DFL);
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+    raise(signal_number);
 }
 
-// This function is called when the server is stopping.
-// It tries to send all pending messages (SCORING) and disconnects all clients.
-// After one second, server begins a new game.
-void reset_server(ServerLogic& server_logic) {
-    // Send pending messages to clients
-    for (size_t i = 1; i < poll_fds.size(); i++) {
-        auto& pollfd = poll_fds[i];
-        while (server_logic.has_pending_messages(pollfd.fd)) {
-            std::string msg_str = server_logic.take_next_message_str(pollfd.fd);
-            if (msg_str.empty()) {
-                break;
-            }
-            ssize_t bytes_written = send(pollfd.fd, msg_str.c_str(), msg_str.size(), 0);
-            if (bytes_written != (ssize_t)msg_str.size()) {
-                break;
-            }
-        }
-    }
-
-    // Disconnect clients
-    for (size_t i = 1; i < poll_fds.size(); i++) {
-        auto& pollfd = poll_fds[i];
-        close(pollfd.fd);
-    }
-    poll_fds.resize(1); // only listening socket remains
-    client_buffers.clear();
-
-    // Wait for one second before starting a new game
-    std::this_thread::sleep_for(std::chrono::milliseconds(constants::reset_delay));
-}
+} // namespace
 
 int main(int argc, char* argv[]) {
     std::cout << std::fixed << std::setprecision(constants::max_fractional_digits);
@@ -205,74 +51,60 @@ int main(int argc, char* argv[]) {
     ServerArgParser arg_parser(argc, argv);
     arg_parser.logInfo();
 
-    int listening_fd =
-        setup_listening_socket(arg_parser.getPort(), constants::listening_socket_backlog);
-
-    poll_fds.push_back({listening_fd, POLLIN, 0});
-
-    EventManager event_manager{};
-    ServerLogic server_logic(arg_parser.getK(), arg_parser.getN(), arg_parser.getM(),
-                             arg_parser.getFile(), event_manager);
-
-    constexpr int poll_timeout = 100; // milliseconds
-    while (true) {
-        int ready = poll(poll_fds.data(), poll_fds.size(), poll_timeout);
-        if (ready < 0) {
-            syserr("poll");
-        }
-
-        if (server_logic.is_stopping()) {
-            reset_server(server_logic);
-            server_logic.reset();
-            continue;
-        }
-
-        event_manager.check_timers();
-
-        for (size_t i = 1; i < poll_fds.size(); i++) {
-            if (server_logic.has_pending_messages(poll_fds[i].fd)) {
-                poll_fds[i].events |= POLLOUT;
-            }
-        }
-
-        if (ready == 0) { // no revents (poll timeout)
-            continue;
-        }
+    int reactors = arg_parser.getReactors();
+    bool reuse_port = reactors > 1;
+
+    // Every shard listens on its own socket, the kernel balances connections between them.
+    // If any port was requested, the other sockets bind to the one chosen for the first.
+    std::vector<int> listening_fds;
+    uint16_t port = arg_parser.getPort();
+    for (int i = 0; i < reactors; i++) {
+        listening_fds.push_back(
+            setup_listening_socket(port, arg_parser.getListeningBacklog(), reuse_port));
+        port = get_local_port(listening_fds.back());
+    }
 
-        if (poll_fds[0].revents & POLLIN) { // new connection
-            handle_new_connection(listening_fd, server_logic, event_manager);
+    // Blocked before any thread is started, so that all of them inherit the mask.
+    sigset_t termination_signals;
+    sigemptyset(&termination_signals);
+    sigaddset(&termination_signals, SIGINT);
+    sigaddset(&termination_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &termination_signals, nullptr);
+
+    // Lines are formatted and printed by the log thread from now on.
+    ServerLog server_log(arg_parser.getLogLevel(), arg_parser.getLogSampleInterval(),
+                         arg_parser.areLogTimestampsEnabled(), reactors);
+    server_log_to_drain = &server_log;
+    std::atexit(drain_server_log);
+    std::thread(handle_termination_signals, termination_signals).detach();
+    GameCoordinator coordinator(arg_parser.getRooms(), arg_parser.getRoomSize(),
+                                arg_parser.getFile(), reactors, arg_parser.getLogQueues());
+
+    // The command line is kept in the trace, so that the server can be started again the
+    // same way for a replay.
+    std::unique_ptr<TraceFile> trace_file;
+    if (!arg_parser.getCaptureFile().empty()) {
+        std::string command_line = argv[0];
+        for (int i = 1; i < argc; i++) {
+            command_line += ' ';
+            command_line += argv[i];
         }
+        trace_file = std::make_unique<TraceFile>(arg_parser.getCaptureFile(), command_line);
+    }
 
-        for (size_t i = 1; i < poll_fds.size(); i++) { // client sockets
-            auto& pollfd = poll_fds[i];
-
-            if (pollfd.revents & POLLHUP) {
-                disconnect_client(pollfd.fd, i, server_logic,
-                                  server_logic.getClientPlayerID(pollfd.fd));
-                continue;
-            }
-
-            if (pollfd.revents & (POLLIN | POLLERR)) {
-                if (!handle_read_from_client(server_logic, i)) {
-                    continue;
-                }
-            }
-
-            if (server_logic.is_stopping()) {
-                break;
-            }
-
-            if (pollfd.revents & POLLOUT) {
-                if (!handle_write_to_client(server_logic, i)) {
-                    continue;
-                }
-            }
-        } // client sockets
-    } // main server loop
-
-    for (const auto& pollfd : poll_fds) {
-        close(pollfd.fd);
+    // Timers of all shards run on the same clock.
+    GameClock clock(arg_parser.getTimeScale());
+    std::vector<std::unique_ptr<ServerShard>> shards;
+    for (int i = 0; i < reactors; i++) {
+        shards.push_back(
+            std::make_unique<ServerShard>(arg_parser, coordinator, server_log, clock, i,
+                                          listening_fds[i], trace_file.get()));
     }
 
-    return 0;
-}
\ No newline at end of file
+    // The main thread runs the first shard itself.
+    std::vector<std::thread> threads;
+    for (int i = 1; i < reactors; i++) {
+        threads.emplace_back(&ServerShard::run, shards[i].get());
+    }
+    shards[0]->run();
+}
@@ -1,12 +1,16 @@
 #include "arg_parser.h"
 
+#include <getopt.h>
 #include <unistd.h>
 
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "constants.h"
 
@@ -49,7 +53,8 @@ ClientArgParser::ClientArgParser(int argc, char* argv[]) : ArgParser(argc, argv)
 }
 
 void ClientArgParser::printUsage() const {
-    error("Usage: %s -u player_id -s server -p port [-4] [-6] [-a]", argv[0]);
+    error("Usage: %s -u player_id -s server -p port [-4] [-6] [-a] [-d] [-r room] [-w window]",
+          argv[0]);
 }
 
 void ClientArgParser::logInfo() const {
@@ -64,6 +69,12 @@ void ClientArgParser::logInfo() const {
         std::cout << " using auto strategy";
     else
         std::cout << " reading from stdin";
+    if (isStateDeltaRequested())
+        std::cout << " with state deltas";
+    if (getRoom() >= 0)
+        std::cout << " in room " << getRoom();
+    if (getWindow() > 0)
+        std::cout << " with window of " << getWindow() << " puts";
 
     std::cout << "." << std::endl;
 }
@@ -71,7 +82,7 @@ void ClientArgParser::logInfo() const {
 void ClientArgParser::parse() {
     int opt;
 
-    while ((opt = getopt(argc, argv, ":u:s:p:46a")) != -1) {
+    while ((opt = getopt(argc, argv, ":u:s:p:46adr:w:")) != -1) {
         switch (opt) {
             case 'u':
                 player_id = std::string(optarg);
@@ -88,6 +99,9 @@ void ClientArgParser::parse() {
             case '4': force_ipv4 = true; break;
             case '6': force_ipv6 = true; break;
             case 'a': auto_strategy = true; break;
+            case 'd': state_delta = true; break;
+            case 'r': room = parseAndValidateInt(optarg, 0, constants::max_rooms - 1); break;
+            case 'w': window = parseAndValidateInt(optarg, 1, constants::max_put_window); break;
             default: handle_getopt_error(opt, optopt); break;
         }
     }
@@ -124,10 +138,107 @@ void ClientArgParser::validate() {
     }
 }
 
+// LoadgenArgParser
+
+LoadgenArgParser::LoadgenArgParser(int argc, char* argv[]) : ArgParser(argc, argv) {
+    parseAndValidate();
+}
+
+void LoadgenArgParser::printUsage() const {
+    error("Usage: %s -s server -p port [-4] [-6] [-c connections] [-r puts_per_second] "
+          "[-t seconds] [-u id_prefix] [-a] [-d] [-w window]",
+          argv[0]);
+}
+
+void LoadgenArgParser::logInfo() const {
+    std::cout << "Starting " << getConnections() << " players '" << getIdPrefix()
+              << "N' on server [" << getServerAddress() << "]:" << getServerPort();
+
+    if (isIPv4Forced())
+        std::cout << " forcing IPv4";
+    if (isIPv6Forced())
+        std::cout << " forcing IPv6";
+    std::cout << " using " << (isAutoStrategy() ? "auto" : "random") << " strategy";
+    if (isStateDeltaRequested())
+        std::cout << " with state deltas";
+    if (getWindow() > 0)
+        std::cout << " with window of " << getWindow() << " puts";
+    std::cout << ", rate=";
+    if (getPutRate() == 0) {
+        std::cout << "unlimited";
+    } else {
+        std::cout << getPutRate() << " puts/s";
+    }
+
+    std::cout << ", duration=" << getDuration() << " s." << std::endl;
+}
+
+void LoadgenArgParser::parseAndValidate() {
+    int opt;
+
+    while ((opt = getopt(argc, argv, ":s:p:46c:r:t:u:adw:")) != -1) {
+        switch (opt) {
+            case 's':
+                server_address = std::string(optarg);
+                server_address_set = true;
+                break;
+            case 'p':
+                server_port = parseAndValidatePort(optarg, false);
+                server_port_set = true;
+                break;
+            case '4': force_ipv4 = true; break;
+            case '6': force_ipv6 = true; break;
+            case 'c':
+                connections = parseAndValidateInt(optarg, 1, constants::max_loadgen_connections);
+                break;
+            case 'r': put_rate = parseAndValidateInt(optarg, 0, constants::max_loadgen_rate); break;
+            case 't':
+                duration = parseAndValidateInt(optarg, 1, constants::max_loadgen_duration);
+                break;
+            case 'u': id_prefix = std::string(optarg); break;
+            case 'a': auto_strategy = true; break;
+            case 'd': state_delta = true; break;
+            case 'w': window = parseAndValidateInt(optarg, 1, constants::max_put_window); break;
+            default: handle_getopt_error(opt, optopt); break;
+        }
+    }
+
+    if (force_ipv4 && force_ipv6) { // Cannot force both IPv4 and IPv6
+        force_ipv4 = force_ipv6 = false;
+    }
+
+    if (optind < argc) {
+        printUsage();
+        fatal("Extra argument: %s", argv[optind]);
+    }
+
+    if (!server_address_set || server_address.empty()) {
+        printUsage();
+        fatal("Server address (-s) is required");
+    }
+    if (!server_port_set) {
+        printUsage();
+        fatal("Server port (-p) is required");
+    }
+
+    for (const char c : id_prefix) {
+        if (!std::isalnum(static_cast<unsigned char>(c))) {
+            printUsage();
+            fatal("ID prefix (-u) must contain only alphanumeric characters");
+        }
+    }
+}
+
 // ServerArgParser
 
 void ServerArgParser::printUsage() const {
-    error("Usage: %s [-p port] [-k value] [-n value] [-m value] -f file", argv[0]);
+    error("Usage: %s [-p port] [-k value] [-n value] [-m value] [-b poll|epoll] "
+          "[-r reactors] [--rooms count | --room K:N:M ...] [--room-size players] "
+          "[--backlog connections] [--accept-batch connections] "
+          "[--output-soft-limit KiB] [--output-hard-limit KiB] "
+          "[--log-level 0-3] [--log-sample N] [--log-timestamps] [--log-queues] "
+          "[--capture trace] [--time-scale factor] [--leaderboard seconds] -f file",
+          argv[0]);
 }
 
 void ServerArgParser::logInfo() const {
@@ -138,18 +249,119 @@ void ServerArgParser::logInfo() const {
         std::cout << getPort();
     }
 
-    std::cout << ", k=" << getK() << ", n=" << getN() << ", m=" << getM() << ", file='"
-              << getFile() << "'." << std::endl;
+    std::cout << ", k=" << getK() << ", n=" << getN() << ", m=" << getM();
+    if (!rooms.empty() || room_count > 1) {
+        std::vector<RoomConfig> room_configs = getRooms();
+        std::cout << ", rooms=";
+        for (size_t i = 0; i < room_configs.size(); i++) {
+            std::cout << (i == 0 ? "" : ",") << room_configs[i].K << ":" << room_configs[i].N
+                      << ":" << room_configs[i].M;
+        }
+        std::cout << ", room size=";
+        if (getRoomSize() == 0) {
+            std::cout << "unlimited";
+        } else {
+            std::cout << getRoomSize();
+        }
+    }
+    std::cout << ", file='" << getFile() << "', backend=" << reactor_backend_name(getBackend())
+              << ", reactors=" << getReactors() << ", backlog=" << listening_backlog
+              << ", accept batch=" << accept_batch << ", output limits=" << output_soft_limit
+              << "/" << output_hard_limit << " KiB, log level=" << (int)log_level
+              << ", log sample=" << log_sample_interval;
+    if (getLogQueues()) {
+        std::cout << ", output queues logged";
+    }
+    if (!getCaptureFile().empty()) {
+        std::cout << ", capture='" << getCaptureFile() << "'";
+    }
+    if (getTimeScale() != 1) {
+        std::cout << ", time scale=" << getTimeScale();
+    }
+    if (getLeaderboardInterval() != 0) {
+        std::cout << ", leaderboard every " << getLeaderboardInterval() << " s";
+    }
+    std::cout << "." << std::endl;
 }
 
 ServerArgParser::ServerArgParser(int argc, char* argv[]) : ArgParser(argc, argv) {
     parseAndValidate();
 }
 
+std::vector<RoomConfig> ServerArgParser::getRooms() const {
+    if (!rooms.empty()) {
+        return rooms;
+    }
+    return std::vector<RoomConfig>(room_count, RoomConfig{k, n, m});
+}
+
+RoomConfig ServerArgParser::parseRoom(const char* str) {
+    std::string params(str);
+    size_t first = params.find(':');
+    size_t second = first == std::string::npos ? first : params.find(':', first + 1);
+    if (second == std::string::npos) {
+        printUsage();
+        fatal("%s is not a valid room (expected K:N:M)", str);
+    }
+    params[first] = params[second] = '\0';
+
+    return RoomConfig{
+        parseAndValidateInt(params.c_str(), 1, constants::max_k),
+        parseAndValidateInt(params.c_str() + first + 1, 1, constants::max_n),
+        parseAndValidateInt(params.c_str() + second + 1, 1, constants::max_m),
+    };
+}
+
+ReactorBackend ServerArgParser::parseBackend(const char* str) {
+    if (strcmp(str, "epoll") == 0) {
+        return ReactorBackend::EPOLL;
+    } else if (strcmp(str, "poll") == 0) {
+        return ReactorBackend::POLL;
+    }
+    printUsage();
+    fatal("%s is not a valid backend (expected poll or epoll)", str);
+}
+
 void ServerArgParser::parseAndValidate() {
+    // Values returned for options that have only the long form.
+    enum {
+        OPT_LEADERBOARD = 256,
+        OPT_OUTPUT_SOFT_LIMIT,
+        OPT_OUTPUT_HARD_LIMIT,
+        OPT_LOG_QUEUES,
+        OPT_LOG_LEVEL,
+        OPT_LOG_SAMPLE,
+        OPT_LOG_TIMESTAMPS,
+        OPT_ROOMS,
+        OPT_ROOM,
+        OPT_ROOM_SIZE,
+        OPT_BACKLOG,
+        OPT_ACCEPT_BATCH,
+        OPT_CAPTURE,
+        OPT_TIME_SCALE,
+    };
+    static const struct option long_options[] = {
+        {"backend", required_argument, nullptr, 'b'},
+        {"reactors", required_argument, nullptr, 'r'},
+        {"leaderboard", required_argument, nullptr, OPT_LEADERBOARD},
+        {"output-soft-limit", required_argument, nullptr, OPT_OUTPUT_SOFT_LIMIT},
+        {"output-hard-limit", required_argument, nullptr, OPT_OUTPUT_HARD_LIMIT},
+        {"log-queues", no_argument, nullptr, OPT_LOG_QUEUES},
+        {"log-level", required_argument, nullptr, OPT_LOG_LEVEL},
+        {"log-sample", required_argument, nullptr, OPT_LOG_SAMPLE},
+        {"log-timestamps", no_argument, nullptr, OPT_LOG_TIMESTAMPS},
+        {"rooms", required_argument, nullptr, OPT_ROOMS},
+        {"room", required_argument, nullptr, OPT_ROOM},
+        {"room-size", required_argument, nullptr, OPT_ROOM_SIZE},
+        {"backlog", required_argument, nullptr, OPT_BACKLOG},
+        {"accept-batch", required_argument, nullptr, OPT_ACCEPT_BATCH},
+        {"capture", required_argument, nullptr, OPT_CAPTURE},
+        {"time-scale", required_argument, nullptr, OPT_TIME_SCALE},
+        {nullptr, 0, nullptr, 0},
+    };
     int opt;
 
-    while ((opt = getopt(argc, argv, ":p:k:n:m:f:")) != -1) {
+    while ((opt = getopt_long(argc, argv, ":p:k:n:m:f:b:r:", long_options, nullptr)) != -1) {
         switch (opt) {
             case 'p': port = parseAndValidatePort(optarg, true); break;
             case 'k': k = parseAndValidateInt(optarg, 1, constants::max_k); break;
@@ -159,6 +371,55 @@ void ServerArgParser::parseAndValidate() {
                 file = std::string(optarg);
                 file_set = true;
                 break;
+            case 'b': backend = parseBackend(optarg); break;
+            case 'r': reactors = parseAndValidateInt(optarg, 1, constants::max_reactors); break;
+            case OPT_LEADERBOARD:
+                leaderboard_interval =
+                    parseAndValidateInt(optarg, 0, constants::max_leaderboard_interval);
+                break;
+            case OPT_OUTPUT_SOFT_LIMIT:
+                output_soft_limit = parseAndValidateInt(optarg, constants::min_output_limit,
+                                                        constants::max_output_limit);
+                break;
+            case OPT_OUTPUT_HARD_LIMIT:
+                output_hard_limit = parseAndValidateInt(optarg, constants::min_output_limit,
+                                                        constants::max_output_limit);
+                break;
+            case OPT_LOG_QUEUES: log_queues = true; break;
+            case OPT_LOG_LEVEL:
+                log_level = (LogLevel)parseAndValidateInt(optarg, (int)LogLevel::GAMES,
+                                                          (int)LogLevel::STATES);
+                break;
+            case OPT_LOG_SAMPLE:
+                log_sample_interval =
+                    parseAndValidateInt(optarg, 1, constants::max_log_sample_interval);
+                break;
+            case OPT_LOG_TIMESTAMPS: log_timestamps = true; break;
+            case OPT_ROOMS:
+                room_count = parseAndValidateInt(optarg, 1, constants::max_rooms);
+                room_count_set = true;
+                break;
+            case OPT_ROOM:
+                if (rooms.size() == constants::max_rooms) {
+                    printUsage();
+                    fatal("At most %lu rooms are allowed", constants::max_rooms);
+                }
+                rooms.push_back(parseRoom(optarg));
+                break;
+            case OPT_ROOM_SIZE:
+                room_size = parseAndValidateInt(optarg, 0, constants::max_room_size);
+                break;
+            case OPT_BACKLOG:
+                listening_backlog =
+                    parseAndValidateInt(optarg, 1, constants::max_listening_backlog);
+                break;
+            case OPT_ACCEPT_BATCH:
+                accept_batch = parseAndValidateInt(optarg, 1, constants::max_accept_batch);
+                break;
+            case OPT_CAPTURE: capture_file = std::string(optarg); break;
+            case OPT_TIME_SCALE:
+                time_scale = parseAndValidateInt(optarg, 1, constants::max_time_scale);
+                break;
             default: handle_getopt_error(opt, optopt); break;
         }
     }
@@ -172,4 +433,85 @@ void ServerArgParser::parseAndValidate() {
         printUsage();
         fatal("File name (-f) is required");
     }
-}
\ No newline at end of file
+
+    if (room_count_set && !rooms.empty()) {
+        printUsage();
+        fatal("Options --rooms and --room cannot be combined");
+    }
+
+    if (output_soft_limit > output_hard_limit) {
+        printUsage();
+        fatal("Output soft limit (%d KiB) is above the hard limit (%d KiB)", output_soft_limit,
+              output_hard_limit);
+    }
+}
+
+// ReplayArgParser
+
+ReplayArgParser::ReplayArgParser(int argc, char* argv[]) : ArgParser(argc, argv) {
+    parseAndValidate();
+}
+
+void ReplayArgParser::printUsage() const {
+    error("Usage: %s -s server -p port -f trace [-4] [-6] [-x] [-t idle_seconds]", argv[0]);
+}
+
+void ReplayArgParser::logInfo() const {
+    std::cout << "Replaying '" << getTraceFile() << "' on server [" << getServerAddress()
+              << "]:" << getServerPort();
+
+    if (isIPv4Forced())
+        std::cout << " forcing IPv4";
+    if (isIPv6Forced())
+        std::cout << " forcing IPv6";
+    std::cout << (isFast() ? " as fast as possible" : " at the recorded pace")
+              << ", idle timeout=" << getIdleTimeout() << " s." << std::endl;
+}
+
+void ReplayArgParser::parseAndValidate() {
+    int opt;
+
+    while ((opt = getopt(argc, argv, ":s:p:f:46xt:")) != -1) {
+        switch (opt) {
+            case 's':
+                server_address = std::string(optarg);
+                server_address_set = true;
+                break;
+            case 'p':
+                server_port = parseAndValidatePort(optarg, false);
+                server_port_set = true;
+                break;
+            case 'f': trace_file = std::string(optarg); break;
+            case '4': force_ipv4 = true; break;
+            case '6': force_ipv6 = true; break;
+            case 'x': fast = true; break;
+            case 't':
+                idle_timeout =
+                    parseAndValidateInt(optarg, 1, constants::max_replay_idle_timeout);
+                break;
+            default: handle_getopt_error(opt, optopt); break;
+        }
+    }
+
+    if (force_ipv4 && force_ipv6) { // Cannot force both IPv4 and IPv6
+        force_ipv4 = force_ipv6 = false;
+    }
+
+    if (optind < argc) {
+        printUsage();
+        fatal("Extra argument: %s", argv[optind]);
+    }
+
+    if (!server_address_set || server_address.empty()) {
+        printUsage();
+        fatal("Server address (-s) is required");
+    }
+    if (!server_port_set) {
+        printUsage();
+        fatal("Server port (-p) is required");
+    }
+    if (trace_file.empty()) {
+        printUsage();
+        fatal("Trace file (-f) is required");
+    }
+}
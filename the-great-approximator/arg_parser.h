@@ -6,7 +6,11 @@
 #include <string>
 #include <vector>
 
+#include "constants.h"
 #include "err.h"
+#include "reactor.h"
+#include "room_config.h"
+#include "server_log.h"
 
 class ArgParser {
  public:
@@ -42,6 +46,9 @@ class ClientArgParser : public ArgParser {
     bool isIPv4Forced() const { return force_ipv4; }
     bool isIPv6Forced() const { return force_ipv6; }
     bool isAutoStrategy() const { return auto_strategy; }
+    bool isStateDeltaRequested() const { return state_delta; }
+    int getRoom() const { return room; } // -1: chosen by the server
+    int getWindow() const { return window; } // 0: one put at a time
 
  private:
     void parse();
@@ -56,6 +63,49 @@ class ClientArgParser : public ArgParser {
     bool force_ipv4 = false;
     bool force_ipv6 = false;
     bool auto_strategy = false;
+    bool state_delta = false;
+    int room = -1;
+    int window = 0;
+};
+
+class LoadgenArgParser : public ArgParser {
+ public:
+    // Constructor parses arguments.
+    // On failure, exits with code 1 and prints an error message to stderr.
+    LoadgenArgParser(int argc, char* argv[]);
+
+    void printUsage() const override;
+    void logInfo() const override;
+
+    // Getters
+    const std::string& getServerAddress() const { return server_address; }
+    uint16_t getServerPort() const { return server_port; }
+    bool isIPv4Forced() const { return force_ipv4; }
+    bool isIPv6Forced() const { return force_ipv6; }
+    int getConnections() const { return connections; }
+    int getPutRate() const { return put_rate; } // PUTs per second in total, 0: unlimited
+    int getDuration() const { return duration; } // seconds
+    const std::string& getIdPrefix() const { return id_prefix; }
+    bool isAutoStrategy() const { return auto_strategy; }
+    bool isStateDeltaRequested() const { return state_delta; }
+    int getWindow() const { return window; } // requested in HELLO, 0: one PUT at a time
+
+ private:
+    void parseAndValidate();
+
+    std::string server_address;
+    bool server_address_set = false;
+    uint16_t server_port;
+    bool server_port_set = false;
+    bool force_ipv4 = false;
+    bool force_ipv6 = false;
+    int connections = 100;
+    int put_rate = 0;
+    int duration = 10;
+    std::string id_prefix = "LOAD"; // lowercase letters would delay the answers of the server
+    bool auto_strategy = false;
+    bool state_delta = false;
+    int window = 0;
 };
 
 class ServerArgParser : public ArgParser {
@@ -72,17 +122,84 @@ class ServerArgParser : public ArgParser {
     int getK() const { return k; }
     int getN() const { return n; }
     int getM() const { return m; }
+    // Rooms given with --room, or --rooms copies of the one given by -k, -n and -m.
+    std::vector<RoomConfig> getRooms() const;
+    int getRoomSize() const { return room_size; } // players per room, 0: unlimited
     const std::string& getFile() const { return file; }
+    ReactorBackend getBackend() const { return backend; }
+    int getReactors() const { return reactors; }
+    int getListeningBacklog() const { return listening_backlog; }
+    int getAcceptBatch() const { return accept_batch; } // connections per loop iteration
+    size_t getOutputSoftLimit() const { return (size_t)output_soft_limit * 1024; } // bytes
+    size_t getOutputHardLimit() const { return (size_t)output_hard_limit * 1024; } // bytes
+    LogLevel getLogLevel() const { return log_level; }
+    int getLogSampleInterval() const { return log_sample_interval; }
+    bool areLogTimestampsEnabled() const { return log_timestamps; }
+    int getLeaderboardInterval() const { return leaderboard_interval; } // seconds, 0: none
+    bool getLogQueues() const { return log_queues; } // output queue gauges at game end
+    const std::string& getCaptureFile() const { return capture_file; } // empty: no capture
+    int getTimeScale() const { return time_scale; } // speed of the timers, 1: real time
 
  private:
     void parseAndValidate();
+    ReactorBackend parseBackend(const char* str);
+    RoomConfig parseRoom(const char* str);
 
     uint16_t port = 0;
     int k = 100;
     int n = 4;
     int m = 131;
+    int room_count = 1;
+    bool room_count_set = false;
+    std::vector<RoomConfig> rooms;
+    int room_size = 0;
     std::string file;
     bool file_set = false;
+    ReactorBackend backend = ReactorBackend::EPOLL;
+    int reactors = 1;
+    int listening_backlog = constants::default_listening_backlog;
+    int accept_batch = constants::default_accept_batch;
+    int output_soft_limit = constants::default_output_soft_limit; // KiB
+    int output_hard_limit = constants::default_output_hard_limit; // KiB
+    LogLevel log_level = LogLevel::STATES;
+    int log_sample_interval = 1;
+    bool log_timestamps = false;
+    int leaderboard_interval = 0;
+    bool log_queues = false;
+    std::string capture_file;
+    int time_scale = 1;
+};
+
+class ReplayArgParser : public ArgParser {
+ public:
+    // Constructor parses arguments.
+    // On failure, exits with code 1 and prints an error message to stderr.
+    ReplayArgParser(int argc, char* argv[]);
+
+    void printUsage() const override;
+    void logInfo() const override;
+
+    // Getters
+    const std::string& getServerAddress() const { return server_address; }
+    uint16_t getServerPort() const { return server_port; }
+    bool isIPv4Forced() const { return force_ipv4; }
+    bool isIPv6Forced() const { return force_ipv6; }
+    const std::string& getTraceFile() const { return trace_file; }
+    bool isFast() const { return fast; } // as fast as possible instead of the recorded pace
+    int getIdleTimeout() const { return idle_timeout; } // seconds
+
+ private:
+    void parseAndValidate();
+
+    std::string server_address;
+    bool server_address_set = false;
+    uint16_t server_port;
+    bool server_port_set = false;
+    bool force_ipv4 = false;
+    bool force_ipv6 = false;
+    std::string trace_file;
+    bool fast = false;
+    int idle_timeout = constants::default_replay_idle_timeout;
 };
 
 #endif // ARG_PARSER_H
@@ -0,0 +1,297 @@
+// Microbenchmarks of the hot paths of the server: message formatting and parsing, STATE
+// serialization (also against the stringstream formatting it replaced), doubleToString(),
+// scoring and ThreadSafeQueue.
+// Every benchmark is calibrated to run for a few milliseconds per batch and repeated;
+// the best and median time per operation are printed and written as CSV to the file given
+// as the only argument (bench-results.csv by default), so that runs can be compared.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <ios>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "err.h"
+#include "game_coordinator.h"
+#include "msg_parser.h"
+#include "output_queue.h"
+#include "server_events.h"
+#include "server_log.h"
+#include "server_logic.h"
+#include "ts_queue.h"
+
+namespace {
+
+constexpr auto min_batch_time = std::chrono::milliseconds(5);
+constexpr int repetitions = 9;
+
+// Results are accumulated here, so that the compiler cannot drop the measured work.
+volatile size_t sink;
+
+struct Result {
+    std::string name;
+    uint64_t iterations; // per batch
+    double best_ns;      // per item
+    double median_ns;    // per item
+};
+
+class Bench {
+ public:
+    // Times op(), which processes items_per_call items and returns any number derived from
+    // its results.
+    template <typename Op>
+    void run(const std::string& name, Op&& op, size_t items_per_call = 1) {
+        using Clock = std::chrono::steady_clock;
+        auto time_batch = [&](uint64_t iterations) {
+            size_t local_sink = 0;
+            Clock::time_point start = Clock::now();
+            for (uint64_t i = 0; i < iterations; i++) {
+                local_sink += op();
+            }
+            Clock::duration elapsed = Clock::now() - start;
+            sink = sink + local_sink;
+            return elapsed;
+        };
+
+        uint64_t iterations = 1;
+        while (time_batch(iterations) < min_batch_time) {
+            iterations *= 2;
+        }
+
+        std::vector<double> per_item_ns;
+        for (int i = 0; i < repetitions; i++) {
+            std::chrono::duration<double, std::nano> elapsed = time_batch(iterations);
+            per_item_ns.push_back(elapsed.count() / iterations / items_per_call);
+        }
+        std::sort(per_item_ns.begin(), per_item_ns.end());
+
+        Result result{name, iterations, per_item_ns.front(), per_item_ns[repetitions / 2]};
+        printf("%-36s %12.1f ns %12.1f ns %10" PRIu64 "\n", result.name.c_str(),
+               result.best_ns, result.median_ns, result.iterations);
+        results.push_back(std::move(result));
+    }
+
+    void write_csv(const char* file_name) const {
+        FILE* file = fopen(file_name, "w");
+        if (!file) {
+            syserr("could not open %s", file_name);
+        }
+        fprintf(file, "name,iterations,best_ns,median_ns\n");
+        for (const Result& result : results) {
+            fprintf(file, "%s,%" PRIu64 ",%.3f,%.3f\n", result.name.c_str(), result.iterations,
+                    result.best_ns, result.median_ns);
+        }
+        if (fclose(file) != 0) {
+            syserr("could not write %s", file_name);
+        }
+    }
+
+ private:
+    std::vector<Result> results;
+};
+
+// Values like the sums of puts seen in games.
+std::vector<double> game_values(std::mt19937_64& rng, size_t count) {
+    std::uniform_int_distribution<int> put(-50000000, 50000000);
+    std::vector<double> values(count);
+    for (double& value : values) {
+        value = put(rng) / 1e7 * (1 + rng() % 4);
+    }
+    return values;
+}
+
+// STATE formatted with stringstream, as before std::to_chars.
+std::string reference_state(const std::vector<double>& approx_values) {
+    std::string approx_values_str = "";
+    for (const auto& approx_value : approx_values) {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(constants::max_fractional_digits) << approx_value;
+        approx_values_str += ss.str() + " ";
+    }
+    approx_values_str.pop_back();
+    return "STATE " + approx_values_str + constants::crlf;
+}
+
+// One message of every type, as the server and the clients send them.
+std::vector<std::pair<std::string, Message>> sample_messages(std::mt19937_64& rng) {
+    ScoringMessage scoring;
+    for (int i = 0; i < 100; i++) {
+        scoring.player_ids.push_back("Player" + std::to_string(i));
+        scoring.scores.push_back(rng() % 100000000 / 1e3);
+    }
+
+    return {
+        {"HELLO", HelloMessage{"Player42", false}},
+        {"COEFF", CoeffMessage{game_values(rng, constants::max_n + 1)}},
+        {"PUT", PutMessage{42, -1.2345678}},
+        {"BAD_PUT", BadPutMessage{10001, 3.5}},
+        {"STATE", StateMessage{game_values(rng, 101)}},
+        {"STATE_DELTA", StateDeltaMessage{42, 12.3456789}},
+        {"PENALTY", PenaltyMessage{42, -1.2345678}},
+        {"SCORING", std::move(scoring)},
+        {"WINDOW", WindowMessage{16}},
+    };
+}
+
+void bench_messages(Bench& bench, std::mt19937_64& rng) {
+    std::vector<std::pair<std::string, Message>> messages = sample_messages(rng);
+
+    for (const auto& [type, msg] : messages) {
+        bench.run("format_message/" + type,
+                  [&msg = msg] { return MessageParser::formatMessage(msg).size(); });
+    }
+
+    Message parsed; // reused like in the server and the client
+    for (const auto& [type, msg] : messages) {
+        std::string line = MessageParser::formatMessage(msg);
+        line.resize(line.size() - constants::crlf.size());
+        bench.run("parse_message/" + type, [&line = line, &parsed] {
+            return MessageParser::parseMessage(line, parsed) + parsed.index();
+        });
+    }
+
+    for (int k : {100, 1000, 10000}) {
+        std::vector<double> state = game_values(rng, k + 1);
+        bench.run("format_state/K=" + std::to_string(k),
+                  [&state] { return MessageParser::formatStateMessage(state).size(); });
+    }
+    std::vector<double> full_state = game_values(rng, constants::max_k + 1);
+    bench.run("format_state_stringstream/K=" + std::to_string(constants::max_k),
+              [&full_state] { return reference_state(full_state).size(); });
+}
+
+void bench_double_to_string(Bench& bench, std::mt19937_64& rng) {
+    std::vector<double> values = game_values(rng, 1024);
+    bench.run(
+        "double_to_string",
+        [&values] {
+            size_t total = 0;
+            for (double value : values) {
+                total += MessageParser::doubleToString(value).size();
+            }
+            return total;
+        },
+        values.size());
+}
+
+// ServerLogic::calculate_score() is private; it is timed through collect_scores(), which
+// calls it for every player. The players are registered like real clients, with
+// coefficients read from a temporary file.
+void bench_scoring(Bench& bench, std::mt19937_64& rng) {
+    constexpr int players = 1000;
+    constexpr int k = 100;
+
+    char file_name[] = "/tmp/approx-bench-XXXXXX";
+    int fd = mkstemp(file_name);
+    if (fd < 0) {
+        syserr("mkstemp");
+    }
+    std::string coefficients;
+    for (int i = 0; i < players; i++) {
+        coefficients += "COEFF 1.5 -2.25 0.125 3" + constants::crlf;
+    }
+    if (write(fd, coefficients.data(), coefficients.size()) != (ssize_t)coefficients.size()) {
+        syserr("write");
+    }
+    close(fd);
+
+    GameCoordinator coordinator({RoomConfig{k, 3, constants::max_m}}, 0, file_name, 1, false);
+    unlink(file_name); // the coordinator keeps it mapped
+    EventManager event_manager;
+    ShardLog log(LogLevel::GAMES, 1);
+    ServerLogic logic(coordinator, event_manager, coordinator.getGauges(0).output_memory, log);
+
+    std::uniform_int_distribution<int> point(0, k);
+    struct sockaddr_storage address = {};
+    struct sockaddr_in* ipv4 = (struct sockaddr_in*)&address;
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int client_fd = 0; client_fd < players; client_fd++) {
+        ipv4->sin_port = htons(10000 + client_fd);
+        logic.register_new_client(client_fd, address);
+        logic.handle_client_message(client_fd,
+                                    HelloMessage{"Player" + std::to_string(client_fd), false});
+        logic.handle_client_message(client_fd, PutMessage{point(rng), 2.5});
+    }
+
+    std::vector<std::string> ids;
+    std::vector<double> scores;
+    bench.run(
+        "collect_scores/players=" + std::to_string(players),
+        [&] {
+            logic.collect_scores(0, ids, scores);
+            return scores.size();
+        },
+        players);
+
+    logic.end_game(0); // cancels the responses scheduled in event_manager
+}
+
+void bench_queue(Bench& bench) {
+    ThreadSafeQueue<std::string> queue;
+    std::string message = MessageParser::formatMessage(PutMessage{42, -1.2345678});
+
+    bench.run("ts_queue/push_pop", [&] {
+        queue.push(message);
+        std::string item;
+        queue.try_pop(item);
+        return item.size();
+    });
+
+    // Items handed over from another thread, as between the threads of the client.
+    constexpr int handoff_items = 10000;
+    bench.run(
+        "ts_queue/handoff",
+        [&] {
+            std::thread producer([&] {
+                for (int i = 0; i < handoff_items; i++) {
+                    queue.push(message);
+                }
+            });
+            size_t total = 0;
+            for (int i = 0; i < handoff_items; i++) {
+                total += queue.pop().size();
+            }
+            producer.join();
+            return total;
+        },
+        handoff_items);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        fatal("Usage: %s [output.csv]", argv[0]);
+    }
+    const char* output_file = argc == 2 ? argv[1] : "bench-results.csv";
+
+    std::mt19937_64 rng(2024);
+    Bench bench;
+    printf("%-36s %15s %15s %10s\n", "benchmark", "best/item", "median/item", "iterations");
+    bench_messages(bench, rng);
+    bench_double_to_string(bench, rng);
+    bench_scoring(bench, rng);
+    bench_queue(bench);
+
+    bench.write_csv(output_file);
+    printf("Results written to %s.\n", output_file);
+    return 0;
+}
@@ -14,17 +14,26 @@
 #include <iterator>
 #include <numeric>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <variant>
 #include <vector>
 
 #include "constants.h"
 #include "err.h"
+#include "line_framer.h"
 #include "msg_parser.h"
+#include "poly_kernel.h"
 #include "ts_queue.h"
 
-ClientLogic::ClientLogic(const std::string& player_id, bool is_auto_strategy)
+ClientLogic::ClientLogic(const std::string& player_id, bool is_auto_strategy,
+                         bool is_state_delta, int room, int window)
     : player_id(player_id),
       is_auto_strategy(is_auto_strategy),
+      is_state_delta(is_state_delta),
+      room(room),
+      window(window),
+      server_state(),
       game_over(false),
       incoming_messages(),
       outgoing_messages(),
@@ -32,6 +41,7 @@ ClientLogic::ClientLogic(const std::string& player_id, bool is_auto_strategy)
       K(0),
       K_set(false),
       puts_without_answer(1), // initialized to 1 to wait for coefficients before putting
+      put_window(1),
       waiting_for_put_response(),
       current_approximation(),
       real_values(),
@@ -139,8 +149,8 @@ void ClientLogic::manual_strategy() {
             std::string line = buffer.substr(0, newline_pos);
             buffer.erase(0, newline_pos + 1);
 
-            std::vector<std::string> params;
-            if (!Message::splitParams(line, params)) {
+            ParamList params;
+            if (!MessageParser::splitParams(line, params)) {
                 log_stderr("invalid input line " + line);
                 continue;
             }
@@ -148,8 +158,8 @@ void ClientLogic::manual_strategy() {
             int point;
             double value;
 
-            if (params.size() != 2 || !Message::parseInteger(params[0], point) ||
-                !Message::parseDouble(params[1], value)) {
+            if (params.size() != 2 || !MessageParser::parseInteger(params[0], point) ||
+                !MessageParser::parseDouble(params[1], value)) {
                 log_stderr("invalid input line " + line);
                 continue;
             }
@@ -161,7 +171,7 @@ void ClientLogic::manual_strategy() {
 
 void ClientLogic::auto_strategy() {
     while (!game_over.load()) {
-        if (wait_for_puts(constants::client_timeout)) { // wait for put response from server
+        if (wait_for_puts(constants::client_timeout)) { // wait for a free place in the window
             increment_puts_without_answer();
             std::pair<int, double> best_put = get_best_put();
             send_put_message(best_put.first, best_put.second);
@@ -170,38 +180,18 @@ void ClientLogic::auto_strategy() {
 }
 
 void ClientLogic::network_receiver() {
-    std::string recv_buffer;
-    char temp_buf[std::numeric_limits<uint16_t>::max()];
-    bool is_first_message = true;
+    LineFramer input;
 
     while (!game_over.load()) {
-        ssize_t bytes_received =
-            recv(sockfd, temp_buf, std::numeric_limits<uint16_t>::max(), 0);
+        char* free_space = input.prepare();
+        ssize_t bytes_received = recv(sockfd, free_space, input.writable(), 0);
 
         if (bytes_received > 0) {
-            recv_buffer.append(temp_buf, bytes_received);
-
-            size_t crlf_pos;
-            while ((crlf_pos = recv_buffer.find(constants::crlf)) != std::string::npos) {
-                std::string line = recv_buffer.substr(0, crlf_pos + constants::crlf.length());
-                recv_buffer.erase(0, crlf_pos + constants::crlf.length());
-
-                std::unique_ptr<Message> msg = Message::createMessage(line);
-
-                if (msg) {
-                    incoming_messages.push(std::move(msg));
-                } else {
-                    std::string error_msg =
-                        "bad message from " + full_info + ": " +
-                        line.substr(0, line.size() - constants::crlf.length());
-                    if (is_first_message) {
-                        fatal(error_msg.c_str());
-                    } else {
-                        log_stderr(error_msg);
-                    }
-                }
+            input.commit(bytes_received);
 
-                is_first_message = false;
+            std::string_view line;
+            while (input.next_line(line)) {
+                incoming_messages.push(std::string(line)); // parsed by message_processor_thread
             }
         } else if (bytes_received == 0) { // Server closed connection
             game_over.store(true);
@@ -213,21 +203,22 @@ void ClientLogic::network_receiver() {
         }
     }
 
-    if (!recv_buffer.empty()) {
-        log_stderr("partial message remaining in buffer at disconnection: " + recv_buffer);
+    if (!input.pending().empty()) {
+        log_stderr("partial message remaining in buffer at disconnection: " +
+                   std::string(input.pending()));
     }
 }
 
 void ClientLogic::network_sender() {
-    std::unique_ptr<Message> msg;
+    std::string msg;
 
     while (!game_over.load()) {
         if (!outgoing_messages.try_pop_for(msg, constants::client_timeout)) {
             continue;
         }
 
-        const char* msg_ptr = msg->getRawMessage().c_str();
-        ssize_t nleft = msg->getRawMessage().length();
+        const char* msg_ptr = msg.c_str();
+        ssize_t nleft = msg.length();
         ssize_t nwritten = 0;
 
         while (nleft > 0) {
@@ -246,87 +237,100 @@ void ClientLogic::network_sender() {
 }
 
 void ClientLogic::message_processor() {
-    std::unique_ptr<Message> msg;
+    std::string line;
+    Message msg; // reused, so that vectors of repeated STATE messages are reused too
     bool is_first_message = true;
-    bool incorrect_message = false;
     bool scoring_received = false;
 
     while (!game_over.load()) {
-        if (!incoming_messages.try_pop_for(msg, constants::client_timeout)) {
-            continue;
+        if (incoming_messages.try_pop_for(line, constants::client_timeout)) {
+            process_message(line, msg, is_first_message, scoring_received);
         }
+    }
 
-        if (is_first_message) {
-            is_first_message = false;
+    // The receiver may notice that the server closed the connection before the last
+    // messages (SCORING) were processed.
+    while (incoming_messages.try_pop(line)) {
+        process_message(line, msg, is_first_message, scoring_received);
+    }
+
+    if (!scoring_received) {
+        fatal("unexpected server disconnect");
+    }
+}
+
+// The raw line is kept only for logging.
+void ClientLogic::process_message(const std::string& line, Message& msg, bool& is_first_message,
+                                  bool& scoring_received) {
+    bool incorrect_message = !MessageParser::parseMessage(line, msg);
+
+    if (is_first_message) {
+        is_first_message = false;
+        if (!incorrect_message && getMessageType(msg) == MessageType::COEFF) {
+            incorrect_message = !processCoeffMessage(std::get<CoeffMessage>(msg));
+        } else {
             incorrect_message = true;
-            if (msg->getType() == MessageType::COEFF) {
-                incorrect_message =
-                    !processCoeffMessage(dynamic_cast<CoeffMessage*>(msg.get()));
-            }
+        }
 
-            if (incorrect_message) {
-                fatal("bad message from %s: %s", full_info.c_str(),
-                      msg->toRawString().c_str());
-            }
-            continue;
+        if (incorrect_message) {
+            fatal("bad message from %s: %s", full_info.c_str(), line.c_str());
         }
+        return;
+    }
 
-        // Not a first message
-        switch (msg->getType()) {
+    // Not a first message
+    if (!incorrect_message) {
+        switch (getMessageType(msg)) {
             case MessageType::BAD_PUT:
-                incorrect_message =
-                    !processBadPutMessage(dynamic_cast<BadPutMessage*>(msg.get()));
+                incorrect_message = !processBadPutMessage(std::get<BadPutMessage>(msg));
                 break;
             case MessageType::STATE:
-                incorrect_message =
-                    !processStateMessage(dynamic_cast<StateMessage*>(msg.get()));
+                incorrect_message = !processStateMessage(std::get<StateMessage>(msg), line);
+                break;
+            case MessageType::STATE_DELTA:
+                incorrect_message = !processStateDeltaMessage(std::get<StateDeltaMessage>(msg));
                 break;
             case MessageType::PENALTY:
-                incorrect_message =
-                    !processPenaltyMessage(dynamic_cast<PenaltyMessage*>(msg.get()));
+                incorrect_message = !processPenaltyMessage(std::get<PenaltyMessage>(msg));
                 break;
             case MessageType::SCORING:
-                incorrect_message =
-                    !processScoringMessage(dynamic_cast<ScoringMessage*>(msg.get()));
+                incorrect_message = !processScoringMessage(std::get<ScoringMessage>(msg), line);
 
                 if (!incorrect_message) {
                     scoring_received = true;
                 }
                 break;
+            case MessageType::WINDOW:
+                incorrect_message = !processWindowMessage(std::get<WindowMessage>(msg));
+                break;
             default: incorrect_message = true; break;
         }
-
-        if (incorrect_message) {
-            log_stderr("bad message from " + full_info + ": " + msg->toRawString());
-        }
     }
 
-    if (!scoring_received) {
-        fatal("unexpected server disconnect");
+    if (incorrect_message) {
+        log_stderr("bad message from " + full_info + ": " + line);
     }
 }
 
-bool ClientLogic::processCoeffMessage(CoeffMessage* msg) {
+bool ClientLogic::processCoeffMessage(const CoeffMessage& msg) {
     // We already know it is a first message from the server.
     // Correctness of the message has already been checked by the message parser.
-    coeffs = msg->getCoeffs();
+    coeffs = msg.coeffs;
     N = coeffs.size() - 1;
 
     std::string log_msg = "Received coefficients: " +
                           std::accumulate(coeffs.begin(), coeffs.end(), std::string(),
                                           [](std::string a, double b) {
-                                              return a + Message::doubleToString(b) + " ";
+                                              return a + MessageParser::doubleToString(b) + " ";
                                           });
     log_msg.pop_back(); // Remove the last space
     log_stdout(log_msg);
 
     // Since K >= 1 we can already tell that:
     current_approximation.resize(2);
-    real_values.resize(2);
     current_approximation[0] = 0;
     current_approximation[1] = 0;
-    real_values[0] = poly_at(0);
-    real_values[1] = poly_at(1);
+    fill_poly_values(coeffs, 1, real_values);
 
     // We can now put
     decrement_puts_without_answer();
@@ -334,31 +338,28 @@ bool ClientLogic::processCoeffMessage(CoeffMessage* msg) {
     return true;
 }
 
-bool ClientLogic::processBadPutMessage(BadPutMessage* msg) {
-    log_stdout("Received bad put response (" + Message::doubleToString(msg->getValue()) +
-               " in " + std::to_string(msg->getPoint()) + ")");
+bool ClientLogic::processBadPutMessage(const BadPutMessage& msg) {
+    log_stdout("Received bad put response (" + MessageParser::doubleToString(msg.value) +
+               " in " + std::to_string(msg.point) + ")");
     if (is_auto_strategy) {
         decrement_puts_without_answer();
     }
     return true;
 }
 
-bool ClientLogic::processStateMessage(StateMessage* msg) {
-    log_stdout("Received state: " + msg->toRawString().substr(std::string("STATE ").length()));
+bool ClientLogic::processStateMessage(const StateMessage& msg, const std::string& line) {
+    log_stdout("Received state: " + line.substr(std::string("STATE ").length()));
+    server_state = msg.approx_values;
 
     if (is_auto_strategy && !K_set.load()) {
         std::scoped_lock<std::mutex> lock(poly_value_mutex);
-        int K_from_server = msg->getApproxValues().size() - 1;
+        int K_from_server = msg.approx_values.size() - 1;
 
         K.store(K_from_server);
         K_set.store(true);
 
         current_approximation.resize(K_from_server + 1, 0);
-        real_values.resize(K_from_server + 1);
-
-        for (int i = 0; i <= K_from_server; i++) {
-            real_values[i] = poly_at(i);
-        }
+        fill_poly_values(coeffs, K_from_server, real_values);
 
         decrement_puts_without_answer();
         return true;
@@ -369,20 +370,50 @@ bool ClientLogic::processStateMessage(StateMessage* msg) {
     return true;
 }
 
-bool ClientLogic::processPenaltyMessage(PenaltyMessage* msg) {
-    log_stdout("Received penalty response (" + Message::doubleToString(msg->getValue()) +
-               " in " + std::to_string(msg->getPoint()) + ")");
+bool ClientLogic::processStateDeltaMessage(const StateDeltaMessage& msg) {
+    // The server always sends a full STATE first, so the point must be known.
+    if (!is_state_delta || msg.point < 0 || msg.point >= (int)server_state.size()) {
+        return false;
+    }
+
+    server_state[msg.point] = msg.value;
+    log_stdout("Received state delta: " + MessageParser::doubleToString(msg.value) + " in " +
+               std::to_string(msg.point));
+
+    if (is_auto_strategy) {
+        return decrement_puts_without_answer();
+    }
+    return true;
+}
+
+bool ClientLogic::processPenaltyMessage(const PenaltyMessage& msg) {
+    log_stdout("Received penalty response (" + MessageParser::doubleToString(msg.value) +
+               " in " + std::to_string(msg.point) + ")");
     return true;
 }
 
-bool ClientLogic::processScoringMessage(ScoringMessage* msg) {
-    log_stdout("Game end, scoring: " +
-               msg->toRawString().substr(std::string("SCORING ").length()));
+bool ClientLogic::processScoringMessage(const ScoringMessage& /* msg */,
+                                        const std::string& line) {
+    log_stdout("Game end, scoring: " + line.substr(std::string("SCORING ").length()));
 
     game_over.store(true);
     return true;
 }
 
+bool ClientLogic::processWindowMessage(const WindowMessage& msg) {
+    if (window == 0 || msg.window > window) {
+        return false;
+    }
+    log_stdout("Received window of " + std::to_string(msg.window) + " puts");
+
+    std::scoped_lock<std::mutex> lock(puts_without_answer_mutex);
+    if (is_auto_strategy) {
+        put_window = msg.window;
+        waiting_for_put_response.notify_one();
+    }
+    return true;
+}
+
 void ClientLogic::increment_puts_without_answer() {
     std::scoped_lock<std::mutex> lock(puts_without_answer_mutex);
     puts_without_answer++;
@@ -392,7 +423,7 @@ bool ClientLogic::decrement_puts_without_answer() {
     std::scoped_lock<std::mutex> lock(puts_without_answer_mutex);
     if (puts_without_answer > 0) {
         puts_without_answer--;
-        if (puts_without_answer == 0) {
+        if (puts_without_answer < put_window) {
             waiting_for_put_response.notify_one();
         }
         return true;
@@ -403,20 +434,19 @@ bool ClientLogic::decrement_puts_without_answer() {
 bool ClientLogic::wait_for_puts(std::chrono::milliseconds timeout) {
     std::unique_lock<std::mutex> lock(puts_without_answer_mutex);
     waiting_for_put_response.wait_for(lock, timeout,
-                                      [this] { return puts_without_answer == 0; });
-    return puts_without_answer == 0;
+                                      [this] { return puts_without_answer < put_window; });
+    return puts_without_answer < put_window;
 }
 
 void ClientLogic::send_put_message(int point, double value) {
-    std::unique_ptr<Message> msg = PutMessage::createMessage(point, value);
-    log_stdout("Putting " + Message::doubleToString(value) + " in point " +
+    log_stdout("Putting " + MessageParser::doubleToString(value) + " in point " +
                std::to_string(point));
-    outgoing_messages.push(std::move(msg));
+    outgoing_messages.push(MessageParser::formatMessage(PutMessage{point, value}));
 }
 
 void ClientLogic::send_hello_message() {
-    std::unique_ptr<Message> msg = HelloMessage::createMessage(player_id);
-    outgoing_messages.push(std::move(msg));
+    outgoing_messages.push(
+        MessageParser::formatMessage(HelloMessage{player_id, is_state_delta, room, window}));
 }
 
 std::pair<int, double> ClientLogic::get_best_put() {
@@ -440,14 +470,3 @@ std::pair<int, double> ClientLogic::get_best_put() {
     current_approximation[max_idx] += value_to_put;
     return std::make_pair(max_idx, value_to_put);
 }
-
-double ClientLogic::poly_at(int x) {
-    double result = 0;
-    int x_pow = 1;
-    for (int i = 0; i <= N; i++) {
-        result += coeffs[i] * x_pow;
-        x_pow *= x;
-    }
-
-    return result;
-}
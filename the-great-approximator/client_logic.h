@@ -12,7 +12,9 @@
 
 class ClientLogic {
  public:
-    ClientLogic(const std::string& player_id, bool is_auto_strategy);
+    // room < 0 lets the server choose the room; window > 0 asks for a window of puts.
+    ClientLogic(const std::string& player_id, bool is_auto_strategy, bool is_state_delta,
+                int room, int window);
 
     void register_connection(const std::string& server_ip, int server_port, int sockfd);
     void start_threads_and_send_hello();
@@ -21,6 +23,9 @@ class ClientLogic {
  private:
     std::string player_id;       // set in constructor
     bool is_auto_strategy;       // set in constructor
+    bool is_state_delta;         // set in constructor, asks for STATE_DELTA responses
+    int room;                    // set in constructor, requested in HELLO if not negative
+    int window;                  // set in constructor, requested in HELLO if positive
     int sockfd;                  // set in register_connection()
     std::string server_ip;       // set in register_connection()
     int server_port;             // set in register_connection()
@@ -28,16 +33,18 @@ class ClientLogic {
     std::string full_info;       // set in register_connection()
     std::vector<double> coeffs;  // set by first COEFF message internally
     int N;                       // set by first COEFF message internally
+    std::vector<double> server_state; // last STATE, updated by STATE_DELTA messages
     std::atomic<bool> game_over; // initialized in constructor
 
-    ThreadSafeQueue<std::unique_ptr<Message>> incoming_messages;
-    ThreadSafeQueue<std::unique_ptr<Message>> outgoing_messages;
+    ThreadSafeQueue<std::string> incoming_messages; // lines received without CRLF
+    ThreadSafeQueue<std::string> outgoing_messages; // raw messages, with CRLF
     ThreadSafeQueue<std::pair<std::string, bool>> logs; // (message, is_error)
 
     // For auto strategy.
     std::atomic<int> K;
     std::atomic<bool> K_set;
     int puts_without_answer;
+    int put_window; // puts that may wait for answers, granted by WINDOW message
     std::mutex puts_without_answer_mutex;
     std::condition_variable waiting_for_put_response;
     void increment_puts_without_answer();
@@ -62,11 +69,15 @@ class ClientLogic {
     void join_thread(std::thread& thread);
 
     // Message processing.
-    bool processCoeffMessage(CoeffMessage* msg);
-    bool processBadPutMessage(BadPutMessage* msg);
-    bool processStateMessage(StateMessage* msg);
-    bool processPenaltyMessage(PenaltyMessage* msg);
-    bool processScoringMessage(ScoringMessage* msg);
+    void process_message(const std::string& line, Message& msg, bool& is_first_message,
+                         bool& scoring_received);
+    bool processCoeffMessage(const CoeffMessage& msg);
+    bool processBadPutMessage(const BadPutMessage& msg);
+    bool processStateMessage(const StateMessage& msg, const std::string& line);
+    bool processStateDeltaMessage(const StateDeltaMessage& msg);
+    bool processPenaltyMessage(const PenaltyMessage& msg);
+    bool processScoringMessage(const ScoringMessage& msg, const std::string& line);
+    bool processWindowMessage(const WindowMessage& msg);
 
     // Put messages in outgoing_messages queue, handled by network_sender_thread
     void send_put_message(int point, double value);
@@ -74,7 +85,6 @@ class ClientLogic {
 
     // For auto strategy.
     std::pair<int, double> get_best_put();
-    double poly_at(int x);
 
     // Logging.
     void log_stdout(const std::string& msg);
@@ -0,0 +1,148 @@
+#include "coeff_prefetcher.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+#include "constants.h"
+#include "err.h"
+#include "msg_parser.h"
+
+namespace {
+// Parsed part of the file is dropped from the mapping in pieces of at least this size.
+constexpr size_t release_size = 1 << 20;
+} // namespace
+
+CoeffPrefetcher::CoeffPrefetcher(const std::string& file_name)
+    : data(nullptr),
+      size(0),
+      offset(0),
+      released(0),
+      page_size(sysconf(_SC_PAGESIZE)),
+      mutex(),
+      ready_cond(),
+      space_cond(),
+      ready(),
+      exhausted(false),
+      stopping(false),
+      prefetch_thread() {
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        syserr("could not open coefficients file: %s", file_name.c_str());
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        syserr("fstat");
+    }
+    size = file_stat.st_size;
+
+    if (size > 0) { // an empty file cannot be mapped, it has no lines anyway
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            syserr("could not map coefficients file: %s", file_name.c_str());
+        }
+        data = static_cast<const char*>(mapping);
+        madvise(mapping, size, MADV_SEQUENTIAL);
+    }
+    close(fd); // the mapping stays valid
+
+    prefetch_thread = std::thread(&CoeffPrefetcher::prefetch_loop, this);
+}
+
+CoeffPrefetcher::~CoeffPrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    space_cond.notify_all();
+    prefetch_thread.join();
+
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+bool CoeffPrefetcher::pop(Coefficients& out_coefficients) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready_cond.wait(lock, [this] { return !ready.empty() || exhausted; });
+    if (ready.empty()) {
+        return false;
+    }
+
+    out_coefficients = std::move(ready.front());
+    ready.pop_front();
+    space_cond.notify_one();
+    return true;
+}
+
+void CoeffPrefetcher::prefetch_loop() {
+    while (true) {
+        // Parsed without the lock, the file and offset are used only by this thread.
+        Coefficients coefficients;
+        bool parsed = parse_next_line(coefficients);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!parsed) {
+            exhausted = true;
+            ready_cond.notify_all();
+            return;
+        }
+
+        space_cond.wait(lock, [this] {
+            return stopping || ready.size() < constants::coeff_prefetch_depth;
+        });
+        if (stopping) {
+            return;
+        }
+        ready.push_back(std::move(coefficients));
+        ready_cond.notify_one();
+    }
+}
+
+bool CoeffPrefetcher::parse_next_line(Coefficients& out_coefficients) {
+    release_parsed_pages();
+    if (offset >= size) {
+        return false;
+    }
+
+    // Lines end with CRLF; the last line is accepted without the final '\n'.
+    const char* line_start = data + offset;
+    const char* newline = static_cast<const char*>(memchr(line_start, '\n', size - offset));
+    size_t line_length = newline ? newline - line_start : size - offset;
+    offset += newline ? line_length + 1 : line_length;
+
+    std::string_view line(line_start, line_length);
+    if (line.empty() || line.back() != constants::crlf[0]) {
+        return false;
+    }
+    line.remove_suffix(1);
+
+    Message msg;
+    if (!MessageParser::parseMessage(line, msg) || getMessageType(msg) != MessageType::COEFF) {
+        return false;
+    }
+
+    out_coefficients.message.reserve(line.size() + constants::crlf.size());
+    out_coefficients.message.assign(line);
+    out_coefficients.message += constants::crlf;
+    out_coefficients.coeffs = std::move(std::get<CoeffMessage>(msg).coeffs);
+    return true;
+}
+
+// Parsed lines are never read again. Dropping their pages keeps the memory used by the
+// mapping small even for files larger than RAM.
+void CoeffPrefetcher::release_parsed_pages() {
+    size_t release_end = offset / page_size * page_size;
+    if (release_end - released < release_size) {
+        return;
+    }
+    madvise(const_cast<char*>(data) + released, release_end - released, MADV_DONTNEED);
+    released = release_end;
+}
@@ -0,0 +1,54 @@
+#ifndef COEFF_PREFETCHER_H
+#define COEFF_PREFETCHER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Coefficients of the players, read from the coefficients file ahead of demand.
+// The file is memory-mapped and split into lines only as far as needed, so its size does
+// not matter. A background thread parses the lines into a bounded queue of ready COEFF
+// messages; taking the next one does not touch the file.
+class CoeffPrefetcher {
+ public:
+    struct Coefficients {
+        std::string message; // COEFF message as in the file, with CRLF
+        std::vector<double> coeffs;
+    };
+
+    explicit CoeffPrefetcher(const std::string& file_name);
+    ~CoeffPrefetcher();
+    CoeffPrefetcher(const CoeffPrefetcher&) = delete;
+    CoeffPrefetcher& operator=(const CoeffPrefetcher&) = delete;
+
+    // Takes the coefficients of the next line, waiting if they are not parsed yet.
+    // Returns false if the file has no more lines or the next line is not a valid COEFF
+    // message. Thread-safe.
+    bool pop(Coefficients& out_coefficients);
+
+ private:
+    const char* data; // mapping of the whole file
+    size_t size;
+    size_t offset;   // start of the next line to parse
+    size_t released; // file pages before this offset were dropped from the mapping
+    size_t page_size;
+
+    std::mutex mutex; // guards everything below
+    std::condition_variable ready_cond;
+    std::condition_variable space_cond;
+    std::deque<Coefficients> ready;
+    bool exhausted; // no more lines will be added to ready
+    bool stopping;
+
+    std::thread prefetch_thread; // started last
+
+    void prefetch_loop();
+    bool parse_next_line(Coefficients& out_coefficients);
+    void release_parsed_pages();
+};
+
+#endif // COEFF_PREFETCHER_H
@@ -2,12 +2,16 @@
 #define CONSTANTS_H
 
 #include <chrono>
+#include <cstddef>
 #include <string>
 
 namespace constants {
 constexpr unsigned long max_k = 10000;
 constexpr unsigned long max_n = 8;
 constexpr unsigned long max_m = 12341234;
+constexpr unsigned long max_reactors = 256;
+constexpr unsigned long max_rooms = 4096;
+constexpr unsigned long max_room_size = 1000000; // players
 
 constexpr double min_coeff = -100.0;
 constexpr double max_coeff = 100.0;
@@ -22,11 +26,53 @@ constexpr int bad_put_penalty = 10;
 constexpr int bad_put_delay = 1;   // seconds
 constexpr int hello_wait_time = 3; // seconds
 
+// Players using the STATE_DELTA extension get a full STATE once per this many responses.
+constexpr int state_snapshot_interval = 64;
+// Largest window granted to players asking for one in HELLO, in puts waiting for responses.
+constexpr int max_put_window = 64;
+
 const std::string crlf = "\r\n";
 
-constexpr int listening_socket_backlog = 64;
+// Longest line accepted from a client, without CRLF. A PUT takes a few dozen bytes; the rest
+// is room for long player ids in HELLO.
+constexpr size_t max_client_line_length = 1024;
+
+// Connections waiting to be accepted, the kernel caps it at net.core.somaxconn.
+constexpr int default_listening_backlog = 4096;
+constexpr unsigned long max_listening_backlog = 65535;
+// Connections accepted by a shard per loop iteration, the rest wait for the next one.
+constexpr int default_accept_batch = 64;
+constexpr unsigned long max_accept_batch = 65536;
+constexpr size_t write_budget = 256 * 1024; // bytes sent to one client per loop iteration
+// Bounds of the output queue of a connection, in KiB. Reads from a client are paused above
+// the soft limit and resumed below half of it; a client above the hard limit is disconnected.
+constexpr int default_output_soft_limit = 1024;
+constexpr int default_output_hard_limit = 8192;
+constexpr unsigned long min_output_limit = 64;
+constexpr unsigned long max_output_limit = 4 * 1024 * 1024;
 constexpr int reset_delay = 1000; // milliseconds
+// Best players logged with --leaderboard.
+constexpr size_t leaderboard_size = 10;
+constexpr unsigned long max_leaderboard_interval = 86400; // seconds
+// Timers may run faster than real time (--time-scale). The game clock overflows after about
+// 290 years of game time, 106 days of real time at the largest scale.
+constexpr unsigned long max_time_scale = 1000;
+constexpr size_t coeff_prefetch_depth = 1024; // COEFF messages parsed ahead of demand
+constexpr size_t log_ring_size = 4 * 1024 * 1024; // bytes of log records per shard
+constexpr size_t log_payload_limit = 64 * 1024 * 1024; // bytes of STATEs kept by the log
+constexpr unsigned long max_log_sample_interval = 1000000;
 const auto client_timeout = std::chrono::milliseconds(200);
+
+// Load generator.
+constexpr unsigned long max_loadgen_connections = 1000000;
+constexpr unsigned long max_loadgen_rate = 10000000;   // PUTs per second
+constexpr unsigned long max_loadgen_duration = 86400; // seconds
+constexpr double loadgen_max_burst = 0.01; // seconds of PUTs sent at once with a limited rate
+const auto loadgen_reconnect_delay = std::chrono::milliseconds(100);
+
+// Replayer.
+constexpr int default_replay_idle_timeout = 10; // seconds without any progress
+constexpr unsigned long max_replay_idle_timeout = 3600;
 } // namespace constants
 
 #endif // CONSTANTS_H
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// Dense table of per-connection state indexed directly by file descriptor.
+// Lookup, insertion and removal are O(1); iteration visits only live entries.
+
+template <typename T>
+class FdTable {
+ public:
+    FdTable() : slots(), live_fds() {}
+
+    bool contains(int fd) const {
+        return fd >= 0 && (size_t)fd < slots.size() && slots[fd].live_index != not_live;
+    }
+
+    // Inserts a default-constructed value for fd, which must not be present.
+    T& insert(int fd) {
+        assert(fd >= 0 && !contains(fd));
+        if ((size_t)fd >= slots.size()) {
+            slots.resize(fd + 1);
+        }
+        Slot& slot = slots[fd];
+        slot.value = T();
+        slot.live_index = live_fds.size();
+        live_fds.push_back(fd);
+        return slot.value;
+    }
+
+    void erase(int fd) {
+        assert(contains(fd));
+        Slot& slot = slots[fd];
+        int last_fd = live_fds.back();
+        live_fds[slot.live_index] = last_fd;
+        slots[last_fd].live_index = slot.live_index;
+        live_fds.pop_back();
+        slot.live_index = not_live;
+        slot.value = T(); // release memory held by the connection
+    }
+
+    T& operator[](int fd) {
+        assert(contains(fd));
+        return slots[fd].value;
+    }
+
+    const T& operator[](int fd) const {
+        assert(contains(fd));
+        return slots[fd].value;
+    }
+
+    // Descriptors of all live entries, in no particular order.
+    const std::vector<int>& fds() const { return live_fds; }
+
+    size_t size() const { return live_fds.size(); }
+    bool empty() const { return live_fds.empty(); }
+
+    void clear() {
+        for (int fd : live_fds) {
+            slots[fd].live_index = not_live;
+            slots[fd].value = T();
+        }
+        live_fds.clear();
+    }
+
+ private:
+    static constexpr uint32_t not_live = UINT32_MAX;
+
+    struct Slot {
+        T value{};
+        uint32_t live_index = not_live; // position of the fd in live_fds
+    };
+
+    std::vector<Slot> slots;
+    std::vector<int> live_fds;
+};
+
+#endif // FD_TABLE_H
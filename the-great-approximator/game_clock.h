@@ -0,0 +1,38 @@
+#ifndef GAME_CLOCK_H
+#define GAME_CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+// Clock of the timers of the server: response delays, the hello timeout and the pause
+// between games. It runs time_scale times faster than the steady clock, starting from the
+// moment it was created, so that games with delays of seconds can be played in
+// milliseconds. With a scale of 1 it is the steady clock.
+// Its time points are on the scale of the steady clock, but only comparable with each other.
+class GameClock {
+ public:
+    using duration = std::chrono::steady_clock::duration;
+    using time_point = std::chrono::steady_clock::time_point;
+
+    explicit GameClock(int time_scale = 1)
+        : time_scale(time_scale), epoch(std::chrono::steady_clock::now()) {}
+
+    time_point now() const {
+        time_point real_now = std::chrono::steady_clock::now();
+        if (time_scale == 1) {
+            return real_now;
+        }
+        return epoch + (real_now - epoch) * time_scale;
+    }
+
+    // Real milliseconds in which the clock advances by game_ms, rounded up.
+    uint64_t to_real_ms(uint64_t game_ms) const {
+        return (game_ms + time_scale - 1) / time_scale;
+    }
+
+ private:
+    int time_scale;
+    time_point epoch;
+};
+
+#endif // GAME_CLOCK_H
@@ -0,0 +1,181 @@
+#include "game_coordinator.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "err.h"
+#include "msg_parser.h"
+
+GameCoordinator::GameCoordinator(const std::vector<RoomConfig>& room_configs, int room_size,
+                                 const std::string& file_name, int shard_count,
+                                 bool log_queues)
+    : room_count(room_configs.size()),
+      room_size(room_size),
+      shard_count(shard_count),
+      log_queues(log_queues),
+      wakeup_fds(),
+      gauges(std::make_unique<ShardGauges[]>(shard_count)),
+      rooms(std::make_unique<Room[]>(room_configs.size())),
+      coefficients(file_name) {
+    for (int i = 0; i < room_count; i++) {
+        rooms[i].config = room_configs[i];
+    }
+    for (int i = 0; i < shard_count; i++) {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            syserr("eventfd");
+        }
+        wakeup_fds.push_back(fd);
+    }
+}
+
+GameCoordinator::~GameCoordinator() {
+    for (int fd : wakeup_fds) {
+        close(fd);
+    }
+}
+
+size_t GameCoordinator::getQueuedOutputBytes() const {
+    size_t total = 0;
+    for (int i = 0; i < shard_count; i++) {
+        total += gauges[i].output_memory.getCurrent();
+    }
+    return total;
+}
+
+size_t GameCoordinator::getPeakOutputBytes() const {
+    size_t total = 0;
+    for (int i = 0; i < shard_count; i++) {
+        total += gauges[i].output_memory.getPeak();
+    }
+    return total;
+}
+
+size_t GameCoordinator::getPausedClients() const {
+    size_t total = 0;
+    for (int i = 0; i < shard_count; i++) {
+        total += gauges[i].paused_clients.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t GameCoordinator::getEvictedClients() const {
+    uint64_t total = 0;
+    for (int i = 0; i < shard_count; i++) {
+        total += gauges[i].evicted_clients.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+int GameCoordinator::join_room(int requested_room) {
+    if (requested_room >= 0) {
+        return requested_room < room_count && try_join(rooms[requested_room]) ? requested_room
+                                                                                : -1;
+    }
+    for (int i = 0; i < room_count; i++) {
+        if (try_join(rooms[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool GameCoordinator::try_join(Room& room) {
+    int players = room.players.load(std::memory_order_relaxed);
+    do {
+        if (room_size > 0 && players >= room_size) {
+            return false;
+        }
+    } while (!room.players.compare_exchange_weak(players, players + 1,
+                                                 std::memory_order_relaxed));
+    return true;
+}
+
+void GameCoordinator::leave_room(int room) {
+    rooms[room].players.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void GameCoordinator::add_correct_puts(int room, int count) {
+    Room& r = rooms[room];
+    int total = r.total_correct_puts.fetch_add(count, std::memory_order_relaxed) + count;
+    // Only the put that reaches M ends the game and wakes up the other shards.
+    if (total >= r.config.M && !r.game_over.exchange(true, std::memory_order_acq_rel)) {
+        wake_up_shards();
+    }
+}
+
+void GameCoordinator::remove_correct_puts(int room, int count) {
+    rooms[room].total_correct_puts.fetch_sub(count, std::memory_order_relaxed);
+}
+
+uint64_t GameCoordinator::submit_scores(int room, const std::vector<std::string>& ids,
+                                        const std::vector<double>& scores, ShardLog& log) {
+    Room& r = rooms[room];
+    std::lock_guard<std::mutex> lock(r.scoring_mutex);
+    uint64_t submitted_game = r.game_number;
+    r.scoring_ids.insert(r.scoring_ids.end(), ids.begin(), ids.end());
+    r.scoring_scores.insert(r.scoring_scores.end(), scores.begin(), scores.end());
+
+    if (++r.submitted_shards < shard_count) {
+        return submitted_game;
+    }
+
+    // The last shard to submit finishes the game.
+    ScoringMessage scoring{std::move(r.scoring_ids), std::move(r.scoring_scores)};
+    r.scoring_msg = std::make_shared<const std::string>(MessageParser::formatMessage(scoring));
+    r.last_scored_game = submitted_game;
+
+    const size_t prefix_length = std::string("SCORING ").length();
+    std::string game_end =
+        room_count > 1 ? "Game end in room " + std::to_string(room) + ", scoring: "
+                       : "Game end, scoring: ";
+    log.text(game_end + r.scoring_msg->substr(prefix_length, r.scoring_msg->size() -
+                                                                 prefix_length -
+                                                                 constants::crlf.size()));
+    if (log_queues) {
+        log.text("Output queues: " + std::to_string(getQueuedOutputBytes()) +
+                 " bytes queued (peak " + std::to_string(getPeakOutputBytes()) + "), " +
+                 std::to_string(getPausedClients()) + " clients paused, " +
+                 std::to_string(getEvictedClients()) + " evicted");
+    }
+
+    r.game_number++;
+    r.submitted_shards = 0;
+    r.scoring_ids.clear();
+    r.scoring_scores.clear();
+    // No shard is playing in the room now, so nothing races with starting the count from zero.
+    r.total_correct_puts.store(0, std::memory_order_relaxed);
+    r.game_over.store(false, std::memory_order_release);
+
+    wake_up_shards();
+    return submitted_game;
+}
+
+bool GameCoordinator::take_scoring(int room, uint64_t game,
+                                   std::shared_ptr<const std::string>& out_msg) {
+    Room& r = rooms[room];
+    std::lock_guard<std::mutex> lock(r.scoring_mutex);
+    if (r.last_scored_game != game) {
+        return false;
+    }
+    out_msg = r.scoring_msg;
+    return true;
+}
+
+void GameCoordinator::wake_up_shards() {
+    uint64_t one = 1;
+    for (int fd : wakeup_fds) {
+        // Can only fail when the counter would overflow, and then the shard is awake anyway.
+        if (write(fd, &one, sizeof(one)) < 0) {
+            errno = 0;
+        }
+    }
+}
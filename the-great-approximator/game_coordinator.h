@@ -0,0 +1,122 @@
+#ifndef GAME_COORDINATOR_H
+#define GAME_COORDINATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "coeff_prefetcher.h"
+#include "output_queue.h"
+#include "room_config.h"
+#include "server_log.h"
+
+// Memory gauges of one shard, written only by its thread.
+struct alignas(64) ShardGauges {
+    OutputMemoryGauge output_memory; // bytes in the output queues of the shard
+    std::atomic<size_t> paused_clients{0}; // not read from because of a full output queue
+    std::atomic<uint64_t> evicted_clients{0}; // disconnected because of a full output queue
+};
+
+// State of the games shared by all reactor threads ("shards").
+// Players of one shard never interact with players of another, so the only shared parts
+// are the coefficients file and, for every room, its players count, the number of correct
+// puts and the final scoring.
+//
+// Every room plays its own games. A game ends when the total number of correct puts in
+// the room reaches its M. Every shard then submits scores of its players in the room; once
+// all shards have done so, the SCORING message is built and the next game of the room
+// starts. Shards are woken up through their wakeup descriptors (eventfd) and check the
+// state of all rooms.
+class GameCoordinator {
+ public:
+    // Rooms with room_size > 0 accept at most that many players. With log_queues, the output
+    // queue gauges are logged at the end of every game.
+    GameCoordinator(const std::vector<RoomConfig>& room_configs, int room_size,
+                    const std::string& file_name, int shard_count, bool log_queues);
+    ~GameCoordinator();
+    GameCoordinator(const GameCoordinator&) = delete;
+    GameCoordinator& operator=(const GameCoordinator&) = delete;
+
+    // Descriptor becoming readable whenever the shard should check the state of the rooms.
+    int getWakeupFd(int shard_index) const { return wakeup_fds[shard_index]; }
+
+    ShardGauges& getGauges(int shard_index) { return gauges[shard_index]; }
+
+    int getRoomCount() const { return room_count; }
+    const RoomConfig& getRoomConfig(int room) const { return rooms[room].config; }
+
+    // Server-wide sums of the gauges of all shards. The peak is the sum of the peaks of
+    // the shards, so it may exceed the real one.
+    size_t getQueuedOutputBytes() const;
+    size_t getPeakOutputBytes() const;
+    size_t getPausedClients() const;
+    uint64_t getEvictedClients() const;
+
+    // Takes coefficients for the next player, parsed in the background.
+    // Returns false if the coefficients file has no more valid lines.
+    bool next_coefficients(CoeffPrefetcher::Coefficients& out_coefficients) {
+        return coefficients.pop(out_coefficients);
+    }
+
+    // Assigns a new player to requested_room, or for requested_room < 0 to the first room
+    // that is not full (fill-first). Returns the room, or -1 if the requested room does not
+    // exist or is full, or if all rooms are full.
+    int join_room(int requested_room);
+    // Called when a player leaves its room: disconnects or its game ends.
+    void leave_room(int room);
+
+    // Counts correct puts of the current game of the room. Ends the game when there are M
+    // of them.
+    void add_correct_puts(int room, int count);
+    void remove_correct_puts(int room, int count);
+
+    bool is_game_over(int room) const {
+        return rooms[room].game_over.load(std::memory_order_acquire);
+    }
+
+    // Submits scores of the players of one shard for the game of the room that is over.
+    // Returns the number of that game, to be passed to take_scoring().
+    // The last shard to submit logs the end of the game to its log.
+    uint64_t submit_scores(int room, const std::vector<std::string>& ids,
+                           const std::vector<double>& scores, ShardLog& log);
+
+    // If all shards have submitted their scores for the game of the room, stores the raw
+    // SCORING message in out_msg and returns true.
+    // The message is shared by all shards.
+    bool take_scoring(int room, uint64_t game, std::shared_ptr<const std::string>& out_msg);
+
+ private:
+    struct alignas(64) Room {
+        RoomConfig config;
+        std::atomic<int> players{0};
+        std::atomic<int> total_correct_puts{0};
+        std::atomic<bool> game_over{false};
+
+        // Guards everything below.
+        std::mutex scoring_mutex;
+        uint64_t game_number = 0;
+        int submitted_shards = 0;
+        std::vector<std::string> scoring_ids;
+        std::vector<double> scoring_scores;
+        uint64_t last_scored_game = UINT64_MAX; // game_number of scoring_msg
+        std::shared_ptr<const std::string> scoring_msg;
+    };
+
+    const int room_count;
+    const int room_size;
+    const int shard_count;
+    const bool log_queues;
+    std::vector<int> wakeup_fds;
+    std::unique_ptr<ShardGauges[]> gauges;
+    std::unique_ptr<Room[]> rooms;
+
+    CoeffPrefetcher coefficients;
+
+    bool try_join(Room& room);
+    void wake_up_shards();
+};
+
+#endif // GAME_COORDINATOR_H
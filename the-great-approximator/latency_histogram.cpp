@@ -0,0 +1,55 @@
+#include "latency_histogram.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+void LatencyHistogram::record(uint64_t value_ns) {
+    buckets[bucket_of(value_ns)]++;
+    total_count++;
+    total_sum += value_ns;
+    if (value_ns > max_value) {
+        max_value = value_ns;
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    if (total_count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::ceil(q * total_count);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            uint64_t value = bucket_middle(bucket);
+            return value < max_value ? value : max_value;
+        }
+    }
+    return max_value;
+}
+
+// Values with the highest bit at position h >= precision_bits are shifted right until only
+// precision_bits bits are left; the shift selects the power of two, the remaining bits
+// (whose highest one is always set) the bucket within it.
+size_t LatencyHistogram::bucket_of(uint64_t value) {
+    if (value < (1u << precision_bits)) {
+        return value;
+    }
+    int highest_bit = 63 - __builtin_clzll(value);
+    int shift = highest_bit - (precision_bits - 1);
+    return shift * sub_buckets + (value >> shift);
+}
+
+uint64_t LatencyHistogram::bucket_middle(size_t bucket) {
+    if (bucket < (1u << precision_bits)) {
+        return bucket;
+    }
+    int shift = bucket / sub_buckets - 1;
+    uint64_t low = (bucket - shift * sub_buckets) << shift;
+    return low + ((uint64_t)1 << shift) / 2;
+}
@@ -0,0 +1,39 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Histogram of latencies in nanoseconds with a bounded relative error, so that percentiles
+// of any number of samples are computed in constant memory.
+// Values below 2^precision_bits are counted exactly; above, every power of two is split into
+// 2^(precision_bits - 1) buckets of equal width, which keeps the error below 1.6%.
+class LatencyHistogram {
+ public:
+    void record(uint64_t value_ns);
+
+    uint64_t count() const { return total_count; }
+    uint64_t max() const { return max_value; }
+    double mean() const { return total_count ? (double)total_sum / total_count : 0.0; }
+
+    // Value below which fraction q (in [0, 1]) of the samples lie, within the precision of
+    // the buckets. Returns 0 if there are no samples.
+    uint64_t percentile(double q) const;
+
+ private:
+    static constexpr int precision_bits = 7;
+    static constexpr uint64_t sub_buckets = 1 << (precision_bits - 1); // per power of two
+    static constexpr size_t bucket_count =
+        (64 - precision_bits) * sub_buckets + (1 << precision_bits);
+
+    std::array<uint64_t, bucket_count> buckets{};
+    uint64_t total_count = 0;
+    uint64_t max_value = 0;
+    long double total_sum = 0;
+
+    static size_t bucket_of(uint64_t value);
+    static uint64_t bucket_middle(size_t bucket);
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,100 @@
+#include "line_framer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Returns the first '\n' in [p, end), or nullptr.
+const char* find_newline(const char* p, const char* end) {
+#ifdef __SSE2__
+    // Compares 16 bytes at a time.
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    if (p == end) {
+        return nullptr;
+    }
+    return static_cast<const char*>(memchr(p, '\n', end - p));
+}
+
+} // namespace
+
+char* LineFramer::prepare(size_t min_space) {
+    if (begin == end) {
+        begin = end = scan = 0; // everything consumed, compacting is free
+    }
+
+    if (writable() < min_space && begin > 0) {
+        memmove(data.data(), data.data() + begin, end - begin);
+        end -= begin;
+        scan -= begin;
+        begin = 0;
+    }
+
+    if (writable() < min_space) {
+        data.resize(std::max(data.size() * 2, end + min_space));
+    }
+
+    return data.data() + end;
+}
+
+bool LineFramer::next_line(std::string_view& out_line) {
+    const char* base = data.data();
+    const char* newline = find_newline(base + scan, base + end);
+
+    while (newline != nullptr) {
+        size_t pos = newline - base;
+        if (pos > begin && base[pos - 1] == '\r') {
+            size_t line_begin = begin;
+            begin = scan = pos + 1;
+            if (discarding || (max_line_length > 0 && pos - 1 - line_begin > max_line_length)) {
+                discarding = false;
+                dropped_lines++;
+            } else {
+                out_line = std::string_view(base + line_begin, pos - 1 - line_begin);
+                return true;
+            }
+        }
+        newline = find_newline(newline + 1, base + end); // lone '\n' is part of the line
+    }
+
+    scan = end;
+    // The unfinished line may still end with a '\r' already received.
+    if (discarding || (max_line_length > 0 && end - begin > max_line_length + 1)) {
+        drop_line_start();
+    }
+    return false;
+}
+
+size_t LineFramer::take_dropped_lines() {
+    size_t count = dropped_lines;
+    dropped_lines = 0;
+    return count;
+}
+
+// Forgets the received part of the current line except its last byte, which may be the
+// '\r' of the CRLF ending it.
+void LineFramer::drop_line_start() {
+    discarding = true;
+    if (end - begin > 1) {
+        begin = end - 1;
+    }
+}
+
+void LineFramer::clear() {
+    begin = end = scan = 0;
+    discarding = false;
+    dropped_lines = 0;
+}
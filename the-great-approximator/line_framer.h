@@ -0,0 +1,59 @@
+#ifndef LINE_FRAMER_H
+#define LINE_FRAMER_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Input buffer of a connection, splitting the received byte stream into CRLF-terminated
+// lines without copying them.
+// Data is received directly into the free space at the end of the buffer. Consumed lines
+// are skipped by moving an offset; the remaining bytes are moved to the front only when
+// the free space runs out.
+// Optionally lines are limited in length: once the unfinished line is too long, its bytes
+// are dropped as they arrive until its end, so the buffer stays small whatever the peer
+// sends.
+class LineFramer {
+ public:
+    // max_line_length of 0 means no limit.
+    explicit LineFramer(size_t max_line_length = 0) : max_line_length(max_line_length) {}
+
+    // Returns free space of at least min_space bytes to receive data into.
+    // Invalidates views returned by next_line().
+    char* prepare(size_t min_space = default_read_size);
+
+    // Number of bytes that can be written at the pointer returned by prepare().
+    size_t writable() const { return data.size() - end; }
+
+    // Marks count bytes written after prepare() as received.
+    void commit(size_t count) { end += count; }
+
+    // Extracts the next complete line, without CRLF, into out_line. Returns false if there is
+    // none. The view stays valid until the next call to prepare() or clear().
+    // Lines longer than the limit are skipped.
+    bool next_line(std::string_view& out_line);
+
+    // Returns the number of lines skipped for being too long since the last call.
+    size_t take_dropped_lines();
+
+    // Received bytes that are not part of a complete line yet.
+    std::string_view pending() const { return std::string_view(data.data() + begin, end - begin); }
+
+    // Drops all received data. The buffer and the length limit are kept.
+    void clear();
+
+ private:
+    static constexpr size_t default_read_size = 4096;
+
+    std::vector<char> data;
+    size_t begin = 0; // start of the first unconsumed line
+    size_t end = 0;   // end of received data
+    size_t scan = 0;  // data before this offset contains no line terminator
+    size_t max_line_length;
+    bool discarding = false; // the current line is too long, its bytes are dropped
+    size_t dropped_lines = 0;
+
+    void drop_line_start();
+};
+
+#endif // LINE_FRAMER_H
@@ -0,0 +1,132 @@
+// LineFramer against a simple framer that copies the stream into a string, on generated
+// streams received in chunks of random sizes, with and without a limit of the line length.
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "line_framer.h"
+#include "test.h"
+
+namespace {
+
+constexpr int generated_streams = 2000;
+
+struct Framed {
+    std::vector<std::string> lines;
+    size_t dropped = 0;
+    std::string pending;
+};
+
+Framed reference_frame(const std::string& stream, size_t max_line_length) {
+    Framed framed;
+    size_t begin = 0;
+    size_t end;
+    while ((end = stream.find("\r\n", begin)) != std::string::npos) {
+        if (max_line_length > 0 && end - begin > max_line_length) {
+            framed.dropped++;
+        } else {
+            framed.lines.push_back(stream.substr(begin, end - begin));
+        }
+        begin = end + 2;
+    }
+    framed.pending = stream.substr(begin);
+    return framed;
+}
+
+Framed frame(std::mt19937_64& rng, const std::string& stream, size_t max_line_length) {
+    Framed framed;
+    LineFramer framer(max_line_length);
+    size_t received = 0;
+    while (received < stream.size()) {
+        char* free_space = framer.prepare(1 + rng() % 64);
+        size_t chunk = std::min({stream.size() - received, framer.writable(),
+                                 (size_t)(1 + rng() % 48)});
+        memcpy(free_space, stream.data() + received, chunk);
+        framer.commit(chunk);
+        received += chunk;
+
+        std::string_view line;
+        while (framer.next_line(line)) {
+            framed.lines.emplace_back(line);
+        }
+        framed.dropped += framer.take_dropped_lines();
+    }
+    framed.pending = framer.pending();
+    return framed;
+}
+
+void test_generated_streams(std::mt19937_64& rng) {
+    const std::string alphabet = "abc\r\n\r\n";
+    for (int i = 0; i < generated_streams; i++) {
+        std::string stream(rng() % 400, ' ');
+        for (char& c : stream) {
+            c = alphabet[rng() % alphabet.size()];
+        }
+        // Now and then a line much longer than the limit.
+        if (rng() % 4 == 0) {
+            stream.insert(rng() % (stream.size() + 1), std::string(100 + rng() % 200, 'x'));
+        }
+
+        for (size_t max_line_length : {0, 1, 5, 16}) {
+            Framed expected = reference_frame(stream, max_line_length);
+            Framed framed = frame(rng, stream, max_line_length);
+            CHECK(framed.lines == expected.lines);
+            CHECK(framed.dropped == expected.dropped);
+            // A line being dropped keeps only its last byte, it may be the '\r' of its end.
+            if (max_line_length == 0 || expected.pending.size() <= max_line_length + 1) {
+                CHECK(framed.pending == expected.pending);
+            } else {
+                CHECK(framed.pending.size() <= 1);
+            }
+        }
+    }
+}
+
+void test_edge_cases() {
+    LineFramer framer(4);
+    std::string_view line;
+
+    auto receive = [&framer](std::string_view data) {
+        char* free_space = framer.prepare(data.size());
+        memcpy(free_space, data.data(), data.size());
+        framer.commit(data.size());
+    };
+
+    receive("\r\nab\ncd\r\n");
+    CHECK(framer.next_line(line) && line.empty());
+    CHECK(!framer.next_line(line)); // "ab\ncd" is too long, a lone '\n' is part of the line
+    CHECK(framer.take_dropped_lines() == 1);
+
+    receive("abcd\r");
+    CHECK(!framer.next_line(line));
+    receive("\nabcde");
+    CHECK(framer.next_line(line) && line == "abcd"); // exactly the limit
+    CHECK(!framer.next_line(line));
+    receive("fgh\r");
+    CHECK(!framer.next_line(line) && framer.pending().size() <= 1);
+    receive("\nok\r\n");
+    CHECK(framer.next_line(line) && line == "ok");
+    CHECK(framer.take_dropped_lines() == 1);
+    CHECK(framer.take_dropped_lines() == 0);
+
+    // clear() drops the data but keeps the buffer and the limit.
+    receive("abc");
+    size_t buffer_size = framer.writable() + 3;
+    framer.clear();
+    CHECK(framer.pending().empty());
+    CHECK(framer.writable() == buffer_size);
+    receive("abcdef\r\n");
+    CHECK(!framer.next_line(line) && framer.take_dropped_lines() == 1);
+}
+
+} // namespace
+
+void test_line_framer() {
+    std::mt19937_64 rng(2024);
+    test_generated_streams(rng);
+    test_edge_cases();
+}
@@ -0,0 +1,427 @@
+#include "load_generator.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "constants.h"
+#include "err.h"
+#include "networking.h"
+#include "poly_kernel.h"
+
+LoadGenerator::LoadGenerator(const LoadgenArgParser& args)
+    : args(args),
+      server_addr(),
+      server_addr_len(0),
+      reactor(Reactor::create(ReactorBackend::EPOLL)),
+      players(),
+      ready_players(),
+      reconnects(),
+      next_serial(0),
+      put_tokens(0.0),
+      last_refill(),
+      random(std::random_device()()),
+      incoming_message(),
+      counters(),
+      latency(),
+      elapsed_seconds(0.0) {
+    resolve_server_address(args.getServerAddress(), std::to_string(args.getServerPort()),
+                           args.isIPv4Forced(), args.isIPv6Forced(), &server_addr,
+                           &server_addr_len);
+}
+
+void LoadGenerator::run() {
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::seconds(args.getDuration());
+    last_refill = start;
+
+    for (int number = 0; number < args.getConnections(); number++) {
+        connect_player(number);
+    }
+
+    while (true) {
+        Clock::time_point now = Clock::now();
+        if (now >= end) {
+            break;
+        }
+
+        // Connections are opened only here, so that events of a closed descriptor still
+        // waiting in the current batch are never taken for events of a new one.
+        while (!reconnects.empty() && reconnects.front().time <= now) {
+            int number = reconnects.front().number;
+            reconnects.pop_front();
+            connect_player(number);
+        }
+
+        send_puts(now);
+
+        for (const ReadyEvent& event : reactor->wait(wait_timeout(now, end))) {
+            handle_events(event.fd, event.events);
+        }
+    }
+
+    elapsed_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<int> fds = players.fds(); // copied, closing modifies it
+    for (int fd : fds) {
+        reactor->remove(fd);
+        close(fd);
+    }
+    players.clear();
+}
+
+void LoadGenerator::print_report() const {
+    double seconds = elapsed_seconds > 0 ? elapsed_seconds : 1.0;
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+
+    printf("Played %.2f s with %d players (%s strategy%s), %" PRIu64 " connections, %" PRIu64
+           " games ended.\n",
+           elapsed_seconds, args.getConnections(), args.isAutoStrategy() ? "auto" : "random",
+           args.isStateDeltaRequested() ? ", state deltas" : "", counters.connections,
+           counters.games);
+    printf("Throughput: %.1f puts/s, %.1f states/s (%" PRIu64 " puts, %" PRIu64 " states).\n",
+           counters.puts / seconds, counters.states / seconds, counters.puts, counters.states);
+    printf("PUT->STATE latency: p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms, mean %.3f "
+           "ms.\n",
+           ms(latency.percentile(0.50)), ms(latency.percentile(0.99)),
+           ms(latency.percentile(0.999)), ms(latency.max()), latency.mean() / 1e6);
+    printf("Errors: %" PRIu64 " bad puts, %" PRIu64 " penalties, %" PRIu64 " bad messages, %" PRIu64
+           " connect errors, %" PRIu64 " disconnects before scoring.\n",
+           counters.bad_puts, counters.penalties, counters.bad_messages, counters.connect_errors,
+           counters.disconnects);
+}
+
+void LoadGenerator::connect_player(int number) {
+    int fd = start_connecting(&server_addr, server_addr_len);
+    if (fd < 0) {
+        if (counters.connect_errors++ == 0) {
+            error("could not connect to the server");
+        }
+        schedule_reconnect(number, true);
+        return;
+    }
+
+    Player& player = players.insert(fd);
+    player.number = number;
+    player.serial = next_serial++;
+    std::string player_id = args.getIdPrefix() + std::to_string(number);
+    player.output.push(MessageParser::formatMessage(
+        HelloMessage{player_id, args.isStateDeltaRequested(), -1, args.getWindow()}));
+
+    // Sent once connected; the socket becomes writable then.
+    reactor->add(fd, true);
+    counters.connections++;
+}
+
+// A player whose game ended joins the next one right away, a failed one after a delay.
+void LoadGenerator::close_player(int fd, bool failed) {
+    int number = players[fd].number;
+    reactor->remove(fd);
+    close(fd);
+    players.erase(fd);
+    schedule_reconnect(number, failed);
+}
+
+// Immediate reconnections go to the front, so that the queue stays ordered by time.
+void LoadGenerator::schedule_reconnect(int number, bool failed) {
+    if (failed) {
+        reconnects.push_back({Clock::now() + constants::loadgen_reconnect_delay, number});
+    } else {
+        reconnects.push_front({Clock::now(), number});
+    }
+}
+
+void LoadGenerator::handle_events(int fd, uint32_t events) {
+    if (!players.contains(fd)) {
+        return; // closed while handling an earlier event of this batch
+    }
+
+    if (players[fd].connecting) {
+        if (!(events & (reactor_events::writable | reactor_events::hangup |
+                        reactor_events::error))) {
+            return;
+        }
+        if (!finish_connecting(fd)) {
+            return;
+        }
+    }
+
+    if (events & (reactor_events::readable | reactor_events::hangup | reactor_events::error)) {
+        if (!handle_read(fd)) {
+            return;
+        }
+    }
+
+    if (events & reactor_events::writable) {
+        flush_output(fd);
+    }
+}
+
+// Returns whether the connection was established.
+bool LoadGenerator::finish_connecting(int fd) {
+    int socket_error = get_socket_error(fd);
+    if (socket_error != 0) {
+        errno = socket_error;
+        if (counters.connect_errors++ == 0) {
+            error("could not connect to the server");
+        }
+        close_player(fd, true);
+        return false;
+    }
+
+    players[fd].connecting = false;
+    return true;
+}
+
+// Reads and handles messages until the socket is drained, the edge-triggered reactor reports
+// new input only once.
+// Returns whether the connection is still open.
+bool LoadGenerator::handle_read(int fd) {
+    Player& player = players[fd]; // no players are added while events are handled
+    while (true) {
+        char* free_space = player.input.prepare();
+        ssize_t bytes_read = recv(fd, free_space, player.input.writable(), 0);
+
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = 0;
+                return true;
+            } else if (errno == EINTR) {
+                continue;
+            }
+        }
+        if (bytes_read <= 0) { // the server closes the connection after SCORING
+            if (!player.scoring_received) {
+                counters.disconnects++;
+            }
+            close_player(fd, !player.scoring_received);
+            return false;
+        }
+
+        player.input.commit(bytes_read);
+        std::string_view line;
+        while (player.input.next_line(line)) {
+            if (!handle_message(fd, line)) {
+                close_player(fd, true);
+                return false;
+            }
+        }
+    }
+}
+
+// Returns whether the connection is still open.
+bool LoadGenerator::flush_output(int fd) {
+    Player& player = players[fd];
+    if (player.connecting) {
+        return true;
+    }
+
+    if (player.output.flush(fd, SIZE_MAX) == OutputQueue::FlushResult::ERROR) {
+        if (!player.scoring_received) {
+            counters.disconnects++;
+        }
+        close_player(fd, !player.scoring_received);
+        return false;
+    }
+    return true;
+}
+
+// Returns false if the connection has to be closed.
+bool LoadGenerator::handle_message(int fd, std::string_view line) {
+    Player& player = players[fd];
+
+    bool correct = MessageParser::parseMessage(line, incoming_message);
+    MessageType type = getMessageType(incoming_message);
+    if (correct && !player.coefficients_received) {
+        correct = type == MessageType::COEFF;
+    }
+    if (!correct) {
+        if (counters.bad_messages++ == 0) {
+            error("bad message from server: %.*s", (int)line.size(), line.data());
+        }
+        return player.coefficients_received; // nothing can be played without coefficients
+    }
+
+    switch (type) {
+        case MessageType::COEFF:
+            if (player.coefficients_received) {
+                counters.bad_messages++;
+                break;
+            }
+            player.coefficients_received = true;
+            player.coeffs = std::move(std::get<CoeffMessage>(incoming_message).coeffs);
+            // Until the first STATE shows K, only points 0 and 1 are known to be valid.
+            fill_poly_values(player.coeffs, player.max_point, player.real_values);
+            player.approximation.assign(player.max_point + 1, 0.0);
+            ready_players.push_back({fd, player.serial});
+            break;
+        case MessageType::STATE: {
+            const std::vector<double>& values =
+                std::get<StateMessage>(incoming_message).approx_values;
+            if (!player.k_known && !values.empty()) {
+                player.k_known = true;
+                player.max_point = values.size() - 1;
+                fill_poly_values(player.coeffs, player.max_point, player.real_values);
+            }
+            player.approximation = values;
+            player.approximation.resize(player.max_point + 1, 0.0);
+            counters.states++;
+            answer_received(fd, true);
+            break;
+        }
+        case MessageType::STATE_DELTA: {
+            const StateDeltaMessage& delta = std::get<StateDeltaMessage>(incoming_message);
+            if (delta.point >= 0 && delta.point <= player.max_point) {
+                player.approximation[delta.point] = delta.value;
+            }
+            counters.states++;
+            answer_received(fd, true);
+            break;
+        }
+        case MessageType::BAD_PUT:
+            counters.bad_puts++;
+            answer_received(fd, false);
+            break;
+        case MessageType::PENALTY:
+            counters.penalties++;
+            answer_received(fd, false);
+            break;
+        case MessageType::SCORING:
+            counters.games++;
+            player.scoring_received = true;
+            player.put_times.clear();
+            break;
+        case MessageType::WINDOW: {
+            int window = std::get<WindowMessage>(incoming_message).window;
+            if (args.getWindow() == 0 || window > args.getWindow() || player.window != 1) {
+                counters.bad_messages++;
+                break;
+            }
+            for (; player.window < window; player.window++) {
+                ready_players.push_back({fd, player.serial});
+            }
+            break;
+        }
+        default:
+            if (counters.bad_messages++ == 0) {
+                error("bad message from server: %.*s", (int)line.size(), line.data());
+            }
+            break;
+    }
+    return true;
+}
+
+// The player may put again; a STATE answer completes a latency sample.
+void LoadGenerator::answer_received(int fd, bool is_state) {
+    Player& player = players[fd];
+    if (player.put_times.empty()) {
+        return; // not an answer to our put, e.g. after a penalty
+    }
+    if (is_state) {
+        latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           Clock::now() - player.put_times.front())
+                           .count());
+    }
+    player.put_times.pop_front();
+    ready_players.push_back({fd, player.serial});
+}
+
+// With a limited rate, PUT tokens accumulate at that rate up to a short burst; every PUT
+// takes one.
+void LoadGenerator::send_puts(Clock::time_point now) {
+    int rate = args.getPutRate();
+    if (rate > 0) {
+        double burst = std::max(1.0, rate * constants::loadgen_max_burst);
+        double elapsed = std::chrono::duration<double>(now - last_refill).count();
+        put_tokens = std::min(burst, put_tokens + elapsed * rate);
+        last_refill = now;
+    }
+
+    while (!ready_players.empty()) {
+        if (rate > 0 && put_tokens < 1.0) {
+            return;
+        }
+        PendingPlayer next = ready_players.front();
+        ready_players.pop_front();
+        if (!players.contains(next.fd) || players[next.fd].serial != next.serial ||
+            (int)players[next.fd].put_times.size() >= players[next.fd].window ||
+            players[next.fd].scoring_received) {
+            continue; // stale entry of a closed connection
+        }
+
+        if (rate > 0) {
+            put_tokens -= 1.0;
+        }
+        send_put(next.fd);
+    }
+}
+
+void LoadGenerator::send_put(int fd) {
+    Player& player = players[fd];
+    int point;
+    double value;
+    if (args.isAutoStrategy()) {
+        choose_auto_put(player, point, value);
+    } else {
+        choose_random_put(player, point, value);
+    }
+
+    player.output.push(MessageParser::formatMessage(PutMessage{point, value}));
+    player.put_times.push_back(Clock::now());
+    counters.puts++;
+    flush_output(fd);
+}
+
+// The same choice as the auto strategy of approx-client: the point with the largest error,
+// corrected as much as a single put allows.
+void LoadGenerator::choose_auto_put(Player& player, int& out_point, double& out_value) {
+    int best_point = 0;
+    double best_difference = -1.0;
+    for (int x = 0; x <= player.max_point; x++) {
+        double difference = std::fabs(player.real_values[x] - player.approximation[x]);
+        if (difference > best_difference) {
+            best_difference = difference;
+            best_point = x;
+        }
+    }
+
+    out_point = best_point;
+    out_value = std::clamp(player.real_values[best_point] - player.approximation[best_point],
+                           constants::min_put_value, constants::max_put_value);
+}
+
+void LoadGenerator::choose_random_put(Player& player, int& out_point, double& out_value) {
+    out_point = std::uniform_int_distribution<int>(0, player.max_point)(random);
+    out_value = std::uniform_real_distribution<double>(constants::min_put_value,
+                                                       constants::max_put_value)(random);
+}
+
+// Milliseconds until the run ends, a reconnection is due or, with a limited rate, a PUT
+// token for a waiting player is available.
+int LoadGenerator::wait_timeout(Clock::time_point now, Clock::time_point end) const {
+    Clock::duration timeout = end - now;
+    if (!reconnects.empty()) {
+        timeout = std::min(timeout, reconnects.front().time - now);
+    }
+    if (!ready_players.empty() && args.getPutRate() > 0) {
+        std::chrono::duration<double> token_wait((1.0 - put_tokens) / args.getPutRate());
+        timeout = std::min(timeout, std::chrono::duration_cast<Clock::duration>(token_wait));
+    }
+
+    if (timeout <= Clock::duration::zero()) {
+        return 0;
+    }
+    // Rounded up, so that the loop does not spin until the deadline.
+    return std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+}
@@ -0,0 +1,117 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "arg_parser.h"
+#include "fd_table.h"
+#include "latency_histogram.h"
+#include "line_framer.h"
+#include "msg_parser.h"
+#include "output_queue.h"
+#include "reactor.h"
+
+// Simulated players driving a server, all served by one epoll loop.
+// Every player keeps at most one PUT waiting for an answer and puts again once it gets one,
+// as the auto strategy of approx-client does, or as many as the window granted by the server
+// when one is requested; the total PUT rate can be limited. When the
+// server ends a game, the player connects again and joins the next one.
+class LoadGenerator {
+ public:
+    explicit LoadGenerator(const LoadgenArgParser& args);
+    LoadGenerator(const LoadGenerator&) = delete;
+    LoadGenerator& operator=(const LoadGenerator&) = delete;
+
+    // Plays for the requested duration, then closes all connections.
+    void run();
+
+    // Prints throughput, PUT->STATE latency and counts of unexpected responses.
+    void print_report() const;
+
+ private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Player {
+        int number = 0;      // position among the simulated players, part of the id
+        uint64_t serial = 0; // distinguishes connections that reused the same fd
+        bool connecting = true;
+        bool coefficients_received = false;
+        bool scoring_received = false;
+        int window = 1; // PUTs that may wait for answers, raised by a WINDOW message
+        std::deque<Clock::time_point> put_times; // of the PUTs waiting for answers, in order
+        int max_point = 1; // K, once known from the first STATE
+        bool k_known = false;
+        std::vector<double> coeffs;
+        std::vector<double> real_values;   // at points 0..max_point
+        std::vector<double> approximation; // sum of the puts made so far
+        LineFramer input{0}; // no length limit, STATE lines grow with K
+        OutputQueue output;
+    };
+
+    struct PendingPlayer {
+        int fd;
+        uint64_t serial;
+    };
+
+    struct Reconnect {
+        Clock::time_point time;
+        int number;
+    };
+
+    // Statistics of the whole run.
+    struct Counters {
+        uint64_t puts = 0;
+        uint64_t states = 0; // STATE and STATE_DELTA answers
+        uint64_t bad_puts = 0;
+        uint64_t penalties = 0;
+        uint64_t games = 0; // SCORING messages received
+        uint64_t connections = 0;
+        uint64_t connect_errors = 0;
+        uint64_t disconnects = 0; // connections closed before SCORING
+        uint64_t bad_messages = 0;
+    };
+
+    const LoadgenArgParser& args;
+    struct sockaddr_storage server_addr;
+    socklen_t server_addr_len;
+    std::unique_ptr<Reactor> reactor;
+    FdTable<Player> players;
+    // May put, in the order they got their answers; a player is here once per free place
+    // in its window.
+    std::deque<PendingPlayer> ready_players;
+    std::deque<Reconnect> reconnects;        // ordered by time
+    uint64_t next_serial;
+    double put_tokens; // PUTs that may be sent now when the rate is limited
+    Clock::time_point last_refill;
+    std::mt19937_64 random;
+    Message incoming_message;
+    Counters counters;
+    LatencyHistogram latency;
+    double elapsed_seconds;
+
+    void connect_player(int number);
+    void close_player(int fd, bool failed);
+    void schedule_reconnect(int number, bool failed);
+    void handle_events(int fd, uint32_t events);
+    bool finish_connecting(int fd);
+    bool handle_read(int fd);
+    bool flush_output(int fd);
+    bool handle_message(int fd, std::string_view line);
+    void answer_received(int fd, bool is_state);
+
+    void send_puts(Clock::time_point now);
+    void send_put(int fd);
+    void choose_auto_put(Player& player, int& out_point, double& out_value);
+    void choose_random_put(Player& player, int& out_point, double& out_value);
+    int wait_timeout(Clock::time_point now, Clock::time_point end) const;
+};
+
+#endif // LOAD_GENERATOR_H
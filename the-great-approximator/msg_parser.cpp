@@ -2,19 +2,32 @@
 
 #include <algorithm>
 #include <cctype>
-#include <iomanip>
-#include <ios>
+#include <charconv>
+#include <cmath>
 #include <limits>
-#include <regex>
-#include <sstream>
 #include <utility>
+#include <variant>
 
-bool Message::isAlphanumeric(const std::string& str) {
-    return std::all_of(str.begin(), str.end(),
-                       [](char c) { return std::isalnum(static_cast<unsigned char>(c)); });
+namespace {
+constexpr size_t max_integer_digits = 309; // of DBL_MAX
+constexpr size_t max_formatted_double_length =
+    1 + max_integer_digits + 1 + constants::max_fractional_digits;
+
+// Locale-independent versions of std::isdigit and std::isalnum.
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool is_alnum(char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+} // namespace
+
+bool MessageParser::isAlphanumeric(std::string_view str) {
+    return std::all_of(str.begin(), str.end(), is_alnum);
 }
 
-bool Message::isValidIntegerStringFormat(const std::string& str) {
+bool MessageParser::isValidIntegerStringFormat(std::string_view str) {
     if (str.empty())
         return false;
     size_t start_idx = 0;
@@ -23,30 +36,18 @@ bool Message::isValidIntegerStringFormat(const std::string& str) {
             return false;
         start_idx = 1;
     }
-    return std::all_of(str.begin() + start_idx, str.end(), [](unsigned char c) {
-        return std::isdigit(static_cast<unsigned char>(c));
-    });
+    return std::all_of(str.begin() + start_idx, str.end(), is_digit);
 }
 
-bool Message::parseInteger(const std::string& str, int& out_val) {
+bool MessageParser::parseInteger(std::string_view str, int& out_val) {
     if (!isValidIntegerStringFormat(str))
         return false;
-    try {
-        size_t processed_chars = 0;
-        long long temp_val = std::stoll(str, &processed_chars);
-        if (processed_chars != str.length())
-            return false;
-        if (temp_val < std::numeric_limits<int>::min() ||
-            temp_val > std::numeric_limits<int>::max())
-            return false;
-        out_val = static_cast<int>(temp_val);
-        return true;
-    } catch (const std::exception&) {
-        return false;
-    }
+    // Fails on values out of the range of int.
+    std::from_chars_result result = std::from_chars(str.data(), str.data() + str.size(), out_val);
+    return result.ec == std::errc() && result.ptr == str.data() + str.size();
 }
 
-bool Message::isValidDoubleStringFormat(const std::string& str) {
+bool MessageParser::isValidDoubleStringFormat(std::string_view str) {
     if (str.empty())
         return false;
     size_t i = 0;
@@ -57,7 +58,7 @@ bool Message::isValidDoubleStringFormat(const std::string& str) {
     }
 
     bool has_leading_digits = false;
-    while (i < str.length() && std::isdigit(static_cast<unsigned char>(str[i]))) {
+    while (i < str.length() && is_digit(str[i])) {
         has_leading_digits = true;
         i++;
     }
@@ -68,7 +69,7 @@ bool Message::isValidDoubleStringFormat(const std::string& str) {
 
     bool has_fractional_digits = false;
     size_t fractional_digit_count = 0;
-    while (i < str.length() && std::isdigit(static_cast<unsigned char>(str[i]))) {
+    while (i < str.length() && is_digit(str[i])) {
         has_fractional_digits = true;
         fractional_digit_count++;
         if (fractional_digit_count > constants::max_fractional_digits)
@@ -85,27 +86,24 @@ bool Message::isValidDoubleStringFormat(const std::string& str) {
     return true;
 }
 
-bool Message::parseDouble(const std::string& str, double& out_val) {
+bool MessageParser::parseDouble(std::string_view str, double& out_val) {
     if (!isValidDoubleStringFormat(str))
         return false;
-    try {
-        size_t processed_chars = 0;
-        out_val = std::stod(str, &processed_chars);
-        return processed_chars == str.length();
-    } catch (const std::exception&) {
-        return false;
-    }
+    // Fails on values out of the range of double.
+    std::from_chars_result result = std::from_chars(str.data(), str.data() + str.size(), out_val);
+    return result.ec == std::errc() && result.ptr == str.data() + str.size();
 }
 
-bool Message::extractCommandAndParams(const std::string& line, std::string& out_command,
-                                      std::string& out_params) {
+bool MessageParser::extractCommandAndParams(std::string_view line,
+                                            std::string_view& out_command,
+                                            std::string_view& out_params) {
     if (line.empty())
         return false;
 
     size_t space_pos = line.find(' ');
-    if (space_pos == std::string::npos) { // no parameters, whole line is a command
+    if (space_pos == std::string_view::npos) { // no parameters, whole line is a command
         out_command = line;
-        out_params.clear();
+        out_params = std::string_view();
         return true;
     } else if (space_pos == 0) { // no command
         return false;
@@ -118,124 +116,167 @@ bool Message::extractCommandAndParams(const std::string& line, std::string& out_
     }
 }
 
-bool Message::splitParams(const std::string& params, std::vector<std::string>& out_vec) {
-    out_vec.clear();
+// Single pass over the parameters, accepting the same language as the regular expression
+// ([a-zA-Z0-9\-\.]+ )*[a-zA-Z0-9\-\.]+
+bool MessageParser::splitParams(std::string_view params, ParamList& out_params) {
+    out_params.clear();
     if (params.empty()) {
         return true;
     }
 
-    static const std::regex params_regex("([a-zA-Z0-9\\-\\.]+ )*[a-zA-Z0-9\\-\\.]+");
-    if (!std::regex_match(params, params_regex)) {
-        return false;
+    size_t param_start = 0;
+    for (size_t i = 0; i < params.size(); i++) {
+        char c = params[i];
+        if (c == ' ') {
+            if (i == param_start) {
+                return false; // empty parameter: leading or double space
+            }
+            out_params.push_back(params.substr(param_start, i - param_start));
+            param_start = i + 1;
+        } else if (!is_alnum(c) && c != '-' && c != '.') {
+            return false;
+        }
     }
 
-    std::istringstream iss(params);
-
-    std::string param;
-    while (iss >> param) {
-        out_vec.push_back(param);
+    if (param_start == params.size()) {
+        return false; // trailing space
     }
-
+    out_params.push_back(params.substr(param_start));
     return true;
 }
 
-std::unique_ptr<Message> Message::createMessage(const std::string& line) {
-    if (line.size() < 2 || line.substr(line.size() - 2) != constants::crlf) {
-        return nullptr; // missing CRLF
+namespace {
+// Returns the message of type T in msg, keeping its vectors if it already holds one.
+template <typename T>
+T& reuse_or_emplace(Message& msg) {
+    if (T* existing = std::get_if<T>(&msg)) {
+        return *existing;
     }
+    return msg.emplace<T>();
+}
+} // namespace
 
-    std::string cmd_params_str = line.substr(0, line.size() - 2);
-    std::string command_str, params_str;
-    if (!extractCommandAndParams(cmd_params_str, command_str, params_str)) {
-        return nullptr;
+bool MessageParser::parseMessage(std::string_view line, Message& out_msg) {
+    std::string_view command_str, params_str;
+    if (!extractCommandAndParams(line, command_str, params_str)) {
+        return false;
     }
 
-    std::vector<std::string> params;
+    // Parameters are views into the line, used only while parsing.
+    ParamList params;
     if (!splitParams(params_str, params)) {
-        return nullptr;
+        return false;
     }
 
-    std::unique_ptr<Message> msg;
     if (command_str == "HELLO") {
-        msg = std::make_unique<HelloMessage>();
+        return parseParams(params, reuse_or_emplace<HelloMessage>(out_msg));
     } else if (command_str == "COEFF") {
-        msg = std::make_unique<CoeffMessage>();
+        return parseParams(params, reuse_or_emplace<CoeffMessage>(out_msg));
     } else if (command_str == "PUT") {
-        msg = std::make_unique<PutMessage>();
+        return parseParams(params, reuse_or_emplace<PutMessage>(out_msg));
     } else if (command_str == "BAD_PUT") {
-        msg = std::make_unique<BadPutMessage>();
+        return parseParams(params, reuse_or_emplace<BadPutMessage>(out_msg));
     } else if (command_str == "STATE") {
-        msg = std::make_unique<StateMessage>();
+        return parseParams(params, reuse_or_emplace<StateMessage>(out_msg));
+    } else if (command_str == "STATE_DELTA") {
+        return parseParams(params, reuse_or_emplace<StateDeltaMessage>(out_msg));
     } else if (command_str == "PENALTY") {
-        msg = std::make_unique<PenaltyMessage>();
+        return parseParams(params, reuse_or_emplace<PenaltyMessage>(out_msg));
     } else if (command_str == "SCORING") {
-        msg = std::make_unique<ScoringMessage>();
-    } else {
-        return nullptr; // unknown command
+        return parseParams(params, reuse_or_emplace<ScoringMessage>(out_msg));
+    } else if (command_str == "WINDOW") {
+        return parseParams(params, reuse_or_emplace<WindowMessage>(out_msg));
     }
-
-    if (!msg)
-        return nullptr;
-
-    msg->raw_message = line;
-    msg->params = std::move(params);
-
-    if (msg->parseMessage()) {
-        return msg;
-    }
-
-    return nullptr;
+    return false; // unknown command
 }
 
-bool Message::validateIntDoublePair(const std::vector<std::string>& vec, int& out_point,
-                                    double& out_value) {
-    if (vec.size() != 2) {
+bool MessageParser::validateIntDoublePair(const ParamList& params, int& out_point,
+                                          double& out_value) {
+    if (params.size() != 2) {
         return false;
     }
 
-    if (!parseInteger(vec[0], out_point) || !parseDouble(vec[1], out_value)) {
+    if (!parseInteger(params[0], out_point) || !parseDouble(params[1], out_value)) {
         return false;
     }
 
     return true;
 }
 
-std::string Message::doubleToString(double val) {
-    std::stringstream ss;
-    ss << std::fixed << std::setprecision(constants::max_fractional_digits) << val;
-    return ss.str();
+std::string MessageParser::doubleToString(double val) {
+    char buffer[max_formatted_double_length];
+    char* end = formatDouble(val, buffer, buffer + max_formatted_double_length);
+    return std::string(buffer, end);
 }
 
-bool Message::validateIntDoublePairInParams(int& out_point, double& out_value) {
-    return validateIntDoublePair(getParams(), out_point, out_value);
+size_t MessageParser::formattedDoubleLength(double max_abs) {
+    // Powers of ten are exact up to 1e22, larger values get the bound of any double.
+    if (!(max_abs < 1e21)) {
+        return max_formatted_double_length;
+    }
+    // sign, integer part, point and fractional part; rounding may add one integer digit
+    size_t integer_digits = 1;
+    for (double bound = 10.0; bound <= max_abs + 1.0; bound *= 10.0) {
+        integer_digits++;
+    }
+    return 1 + integer_digits + 1 + constants::max_fractional_digits;
 }
 
-bool HelloMessage::parseMessage() {
-    setType(MessageType::HELLO);
-    const std::vector<std::string>& params = getParams();
+char* MessageParser::formatDouble(double val, char* first, char* last) {
+    // Correctly rounded, like the "%.7f" conversion used by iostreams.
+    std::to_chars_result result = std::to_chars(first, last, val, std::chars_format::fixed,
+                                                constants::max_fractional_digits);
+    return result.ptr;
+}
 
-    if (params.size() != 1 || !isAlphanumeric(params[0])) {
+bool MessageParser::parseParams(const ParamList& params, HelloMessage& out_msg) {
+    if (params.size() < 1 || params.size() > 6 || !isAlphanumeric(params[0])) {
         return false;
     }
 
-    player_id = params[0];
+    size_t i = 1;
+    out_msg.state_delta = i < params.size() && params[i] == "DELTA";
+    if (out_msg.state_delta) {
+        i++;
+    }
+    out_msg.window = 0;
+    if (i + 2 <= params.size() && params[i] == "WINDOW") {
+        if (!parseInteger(params[i + 1], out_msg.window) || out_msg.window < 1) {
+            return false;
+        }
+        i += 2;
+    }
+    out_msg.room = -1;
+    if (i + 2 == params.size() && params[i] == "ROOM") {
+        if (!parseInteger(params[i + 1], out_msg.room) || out_msg.room < 0) {
+            return false;
+        }
+        i += 2;
+    }
+    if (i != params.size()) {
+        return false; // unknown extension
+    }
+
+    out_msg.player_id = params[0];
     return true;
 }
 
-bool CoeffMessage::parseMessage() {
-    setType(MessageType::COEFF);
-    const std::vector<std::string>& params = getParams();
+bool MessageParser::parseParams(const ParamList& params, WindowMessage& out_msg) {
+    return params.size() == 1 && parseInteger(params[0], out_msg.window) && out_msg.window >= 1;
+}
 
+bool MessageParser::parseParams(const ParamList& params, CoeffMessage& out_msg) {
     if (params.size() < 1 || params.size() > constants::max_n + 1) {
         return false;
     }
 
+    std::vector<double>& coeffs = out_msg.coeffs;
     coeffs.clear();
     coeffs.reserve(params.size());
 
-    for (const std::string& param : params) {
+    for (size_t i = 0; i < params.size(); i++) {
         coeffs.push_back(0.0);
-        if (!parseDouble(param, coeffs.back())) {
+        if (!parseDouble(params[i], coeffs.back())) {
             return false;
         }
         if (coeffs.back() + constants::eps < constants::min_coeff ||
@@ -247,30 +288,18 @@ bool CoeffMessage::parseMessage() {
     return true;
 }
 
-bool PutMessage::parseMessage() {
-    setType(MessageType::PUT);
-    return validateIntDoublePairInParams(point, value);
-}
-
-bool BadPutMessage::parseMessage() {
-    setType(MessageType::BAD_PUT);
-    return validateIntDoublePairInParams(point, value);
-}
-
-bool StateMessage::parseMessage() {
-    setType(MessageType::STATE);
-    const std::vector<std::string>& params = getParams();
-
+bool MessageParser::parseParams(const ParamList& params, StateMessage& out_msg) {
     if (params.size() < 1 || params.size() > constants::max_k + 1) {
         return false;
     }
 
+    std::vector<double>& approx_values = out_msg.approx_values;
     approx_values.clear();
     approx_values.reserve(params.size());
 
-    for (const std::string& param : params) {
+    for (size_t i = 0; i < params.size(); i++) {
         approx_values.push_back(0.0);
-        if (!parseDouble(param, approx_values.back())) {
+        if (!parseDouble(params[i], approx_values.back())) {
             return false;
         }
     }
@@ -278,27 +307,22 @@ bool StateMessage::parseMessage() {
     return true;
 }
 
-bool PenaltyMessage::parseMessage() {
-    setType(MessageType::PENALTY);
-    return validateIntDoublePairInParams(point, value);
-}
-
-bool ScoringMessage::parseMessage() {
-    setType(MessageType::SCORING);
-    const std::vector<std::string>& params = getParams();
+bool MessageParser::parseParams(const ParamList& params, ScoringMessage& out_msg) {
     size_t num_players = params.size() / 2;
 
     if (num_players * 2 != params.size()) {
         return false;
     }
 
+    std::vector<std::string>& player_ids = out_msg.player_ids;
+    std::vector<double>& scores = out_msg.scores;
     player_ids.clear();
     player_ids.reserve(num_players);
     scores.clear();
     scores.reserve(num_players);
 
     for (size_t i = 0; i < num_players; ++i) {
-        player_ids.push_back(params[i * 2]);
+        player_ids.emplace_back(params[i * 2]);
         scores.push_back(0.0);
         if (!isAlphanumeric(player_ids.back())) {
             return false;
@@ -311,72 +335,90 @@ bool ScoringMessage::parseMessage() {
     return true;
 }
 
-std::unique_ptr<Message> HelloMessage::createMessage(const std::string& player_id) {
-    return createMessageWithCRLF("HELLO " + player_id);
+std::string MessageParser::formatMessage(const Message& msg) {
+    return std::visit([](const auto& typed_msg) { return formatMessage(typed_msg); }, msg);
 }
 
-std::unique_ptr<Message> CoeffMessage::createMessage(const std::vector<double>& coeffs) {
-    if (coeffs.empty()) {
-        return nullptr;
-    }
+std::string MessageParser::formatMessage(const HelloMessage& msg) {
+    return "HELLO " + msg.player_id + (msg.state_delta ? " DELTA" : "") +
+           (msg.window > 0 ? " WINDOW " + std::to_string(msg.window) : "") +
+           (msg.room >= 0 ? " ROOM " + std::to_string(msg.room) : "") + constants::crlf;
+}
 
-    std::string coeffs_str = "";
-    for (const auto& coeff : coeffs) {
-        coeffs_str += doubleToString(coeff) + " ";
+std::string MessageParser::formatMessage(const CoeffMessage& msg) {
+    std::string msg_str = "COEFF";
+    for (const auto& coeff : msg.coeffs) {
+        msg_str += " " + doubleToString(coeff);
     }
-    coeffs_str.pop_back(); // remove last space
-    return createMessageWithCRLF("COEFF " + coeffs_str);
+    return msg_str + constants::crlf;
 }
 
-std::unique_ptr<Message> PutMessage::createMessage(int point, double value) {
-    return createMessageWithCRLF("PUT " + std::to_string(point) + " " + doubleToString(value));
+std::string MessageParser::formatIntDoublePair(std::string_view command, int point,
+                                               double value) {
+    std::string msg_str(command);
+    msg_str += " " + std::to_string(point) + " " + doubleToString(value);
+    return msg_str + constants::crlf;
 }
 
-std::unique_ptr<Message> BadPutMessage::createMessage(int point, double value) {
-    return createMessageWithCRLF("BAD_PUT " + std::to_string(point) + " " +
-                                 doubleToString(value));
+std::string MessageParser::formatMessage(const PutMessage& msg) {
+    return formatIntDoublePair("PUT", msg.point, msg.value);
 }
 
-std::unique_ptr<Message> StateMessage::createMessage(
-    const std::vector<double>& approx_values) {
-    if (approx_values.empty()) {
-        return nullptr;
-    }
+std::string MessageParser::formatMessage(const BadPutMessage& msg) {
+    return formatIntDoublePair("BAD_PUT", msg.point, msg.value);
+}
 
-    std::string approx_values_str = "";
-    for (const auto& approx_value : approx_values) {
-        approx_values_str += doubleToString(approx_value) + " ";
-    }
+std::string MessageParser::formatMessage(const StateMessage& msg) {
+    return formatStateMessage(msg.approx_values);
+}
 
-    approx_values_str.pop_back(); // remove last space
-    return createMessageWithCRLF("STATE " + approx_values_str);
+std::string MessageParser::formatMessage(const StateDeltaMessage& msg) {
+    return formatIntDoublePair("STATE_DELTA", msg.point, msg.value);
 }
 
-std::unique_ptr<Message> PenaltyMessage::createMessage(int point, double value) {
-    return createMessageWithCRLF("PENALTY " + std::to_string(point) + " " +
-                                 doubleToString(value));
+std::string MessageParser::formatMessage(const PenaltyMessage& msg) {
+    return formatIntDoublePair("PENALTY", msg.point, msg.value);
 }
 
-std::unique_ptr<Message> ScoringMessage::createMessage(
-    const std::vector<std::string>& player_ids, const std::vector<double>& scores) {
-    if (player_ids.size() != scores.size()) {
-        return nullptr;
-    }
+std::string MessageParser::formatStateMessage(const std::vector<double>& approx_values) {
+    // The message is formatted in place, into a buffer sized for the largest value.
+    double max_abs = 0.0;
+    for (double approx_value : approx_values) {
+        max_abs = std::max(max_abs, std::fabs(approx_value));
+    }
+    const std::string command = "STATE ";
+    size_t value_length = formattedDoubleLength(max_abs);
+
+    std::string line(command.size() + approx_values.size() * (value_length + 1) + 1, '\0');
+    char* out = line.data();
+    char* last = line.data() + line.size();
+    out = std::copy(command.begin(), command.end(), out);
+    for (double approx_value : approx_values) {
+        out = formatDouble(approx_value, out, last);
+        *out++ = ' ';
+    }
+    out[-1] = constants::crlf[0]; // replaces the last space
+    *out++ = constants::crlf[1];
+    line.resize(out - line.data());
+    return line;
+}
 
+std::string MessageParser::formatMessage(const ScoringMessage& msg) {
     // Sort player_ids and scores by player_ids
     std::vector<std::pair<std::string, double>> player_scores;
-    for (size_t i = 0; i < player_ids.size(); ++i) {
-        player_scores.emplace_back(player_ids[i], scores[i]);
+    for (size_t i = 0; i < msg.player_ids.size() && i < msg.scores.size(); ++i) {
+        player_scores.emplace_back(msg.player_ids[i], msg.scores[i]);
     }
     std::sort(player_scores.begin(), player_scores.end());
 
     // Create the message
-    int num_players = player_scores.size();
-    std::string msg_str = "SCORING ";
-    for (int i = 0; i < num_players; ++i) {
-        msg_str +=
-            player_scores[i].first + " " + doubleToString(player_scores[i].second) + " ";
-    }
-    msg_str.pop_back(); // remove last space
-    return createMessageWithCRLF(msg_str);
-}
\ No newline at end of file
+    std::string msg_str = "SCORING";
+    for (const auto& player_score : player_scores) {
+        msg_str += " " + player_score.first + " " + doubleToString(player_score.second);
+    }
+    return msg_str + constants::crlf;
+}
+
+std::string MessageParser::formatMessage(const WindowMessage& msg) {
+    return "WINDOW " + std::to_string(msg.window) + constants::crlf;
+}
@@ -1,166 +1,207 @@
 #ifndef MSG_PARSER_H
 #define MSG_PARSER_H
 
-#include <memory>
+#include <array>
+#include <cstddef>
 #include <string>
+#include <string_view>
+#include <variant>
 #include <vector>
 
 #include "constants.h"
 
-enum class MessageType { HELLO, COEFF, PUT, BAD_PUT, STATE, PENALTY, SCORING };
+enum class MessageType {
+    HELLO,
+    COEFF,
+    PUT,
+    BAD_PUT,
+    STATE,
+    STATE_DELTA,
+    PENALTY,
+    SCORING,
+    WINDOW,
+};
 
-class Message {
+// Parameters of a line, as views into it.
+// Short parameter lists (every message except STATE and SCORING) are stored inline.
+class ParamList {
  public:
-    Message() = default;
-    virtual ~Message() = default;
+    static constexpr size_t inline_capacity = constants::max_n + 1;
 
-    // Simple getters.
-    const std::string& getRawMessage() const { return raw_message; }
-    const std::vector<std::string>& getParams() const { return params; }
-    MessageType getType() const { return type; }
+    ParamList() : inline_params(), overflow(), count(0) {}
 
-    // Returns raw message without CRLF.
-    std::string toRawString() const {
-        return raw_message.substr(0, raw_message.size() - constants::crlf.length());
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    std::string_view operator[](size_t i) const {
+        return i < inline_capacity ? inline_params[i] : overflow[i - inline_capacity];
     }
 
-    // Factory methods.
-    static std::unique_ptr<Message> createMessage(const std::string& line);
-    static std::unique_ptr<Message> createMessageWithCRLF(const std::string& line) {
-        return createMessage(line + constants::crlf);
+    void push_back(std::string_view param) {
+        if (count < inline_capacity) {
+            inline_params[count] = param;
+        } else {
+            overflow.push_back(param);
+        }
+        count++;
     }
 
-    // Returns whether string is alphanumeric.
-    static bool isAlphanumeric(const std::string& str);
-
-    // Returns whether string is a valid integer.
-    // If it is, saves it to out_val.
-    static bool parseInteger(const std::string& str, int& out_val);
-
-    // Returns whether string is a valid double.
-    // If it is, saves it to out_val.
-    static bool parseDouble(const std::string& str, double& out_val);
-
-    // Divides string into command and parameters.
-    // On success, saves command and parameters to out_command and out_params, returning true.
-    static bool extractCommandAndParams(const std::string& line, std::string& out_command,
-                                        std::string& out_params);
-
-    // Splits parameters into a vector of strings.
-    // On success, saves parameters to out_vec, returning true.
-    static bool splitParams(const std::string& params, std::vector<std::string>& out_vec);
-
-    // Validates whether parameters given by vector are a valid integer and double pair.
-    // If they are, saves them to out_point and out_value, returning true.
-    static bool validateIntDoublePair(const std::vector<std::string>& vec, int& out_point,
-                                      double& out_value);
+    void clear() {
+        overflow.clear();
+        count = 0;
+    }
 
-    // Converts double to string with precision constants::max_fractional_digits.
-    static std::string doubleToString(double val);
+ private:
+    std::array<std::string_view, inline_capacity> inline_params;
+    std::vector<std::string_view> overflow;
+    size_t count;
+};
 
- protected:
-    bool validateIntDoublePairInParams(int& out_point, double& out_value);
-    void setType(MessageType type) { this->type = type; }
+// Messages are plain values, parsed straight from the received line; messages made of a point
+// and a value are parsed without allocating. The order of the alternatives in Message matches
+// MessageType.
 
- private:
-    std::string raw_message; // contains CRLF
-    std::vector<std::string> params;
-    MessageType type;
+// Protocol extensions: "HELLO player_id DELTA" asks the server to answer puts with
+// STATE_DELTA messages, with a full STATE only every few responses; "HELLO player_id WINDOW w"
+// asks to have up to w puts waiting for their responses (see WindowMessage);
+// "HELLO player_id ROOM r" asks to play in room r instead of the one chosen by the server.
+// They may be combined, in this order.
+struct HelloMessage {
+    std::string player_id;
+    bool state_delta = false;
+    int room = -1;  // -1: any room
+    int window = 0; // 0: one put at a time, without WINDOW
+};
 
-    static bool isValidIntegerStringFormat(const std::string& str);
-    static bool isValidDoubleStringFormat(const std::string& str);
+struct CoeffMessage {
+    std::vector<double> coeffs;
+};
 
-    virtual bool parseMessage() = 0;
+// Point and value of messages below are not checked to be in correct range.
+struct PutMessage {
+    int point = 0;
+    double value = 0.0;
 };
 
-class HelloMessage : public Message {
- public:
-    static std::unique_ptr<Message> createMessage(const std::string& player_id);
-    const std::string& getPlayerId() const { return player_id; }
+struct BadPutMessage {
+    int point = 0;
+    double value = 0.0;
+};
 
- private:
-    std::string player_id;
+// Values are not checked to be correct nor to be the correct number of them.
+struct StateMessage {
+    std::vector<double> approx_values;
+};
 
-    bool parseMessage() override;
+// Value of the approximation in the only point that changed since the previous state.
+struct StateDeltaMessage {
+    int point = 0;
+    double value = 0.0;
 };
 
-class CoeffMessage : public Message {
- public:
-    static std::unique_ptr<Message> createMessage(const std::vector<double>& coeffs);
-    const std::vector<double>& getCoeffs() const { return coeffs; }
+struct PenaltyMessage {
+    int point = 0;
+    double value = 0.0;
+};
 
- private:
-    std::vector<double> coeffs;
+struct ScoringMessage {
+    std::vector<std::string> player_ids;
+    std::vector<double> scores;
+};
 
-    bool parseMessage() override;
+// Protocol extension: sent after COEFF to a player that asked for a window in HELLO.
+// The player may send up to window puts without waiting for their responses (credits);
+// every STATE, STATE_DELTA or BAD_PUT gives one credit back. The responses come in the order
+// of the puts. A put sent without a credit is discarded and answered with PENALTY at once.
+struct WindowMessage {
+    int window = 1;
 };
 
-class PutMessage : public Message {
- public:
-    static std::unique_ptr<Message> createMessage(int point, double value);
-    int getPoint() const { return point; }
-    double getValue() const { return value; }
+using Message = std::variant<HelloMessage, CoeffMessage, PutMessage, BadPutMessage, StateMessage,
+                             StateDeltaMessage, PenaltyMessage, ScoringMessage, WindowMessage>;
 
- private:
-    int point;
-    double value;
+static_assert(std::variant_size_v<Message> == static_cast<size_t>(MessageType::WINDOW) + 1);
 
-    // Does not check if point and value are in correct range.
-    bool parseMessage() override;
-};
+inline MessageType getMessageType(const Message& msg) {
+    return static_cast<MessageType>(msg.index());
+}
 
-class BadPutMessage : public Message {
+class MessageParser {
  public:
-    static std::unique_ptr<Message> createMessage(int point, double value);
-    int getPoint() const { return point; }
-    double getValue() const { return value; }
+    // Parses a line received without its CRLF into out_msg, returning whether it is a valid
+    // message (out_msg may be partially overwritten otherwise). Vectors of a message of the
+    // same type already in out_msg are reused.
+    static bool parseMessage(std::string_view line, Message& out_msg);
+
+    // Return the raw message, with CRLF.
+    static std::string formatMessage(const Message& msg);
+    static std::string formatMessage(const HelloMessage& msg);
+    static std::string formatMessage(const CoeffMessage& msg);
+    static std::string formatMessage(const PutMessage& msg);
+    static std::string formatMessage(const BadPutMessage& msg);
+    static std::string formatMessage(const StateMessage& msg);
+    static std::string formatMessage(const StateDeltaMessage& msg);
+    static std::string formatMessage(const PenaltyMessage& msg);
+    // Players are sorted by their ids.
+    static std::string formatMessage(const ScoringMessage& msg);
+    static std::string formatMessage(const WindowMessage& msg);
+
+    // Returns the raw STATE message (with CRLF) for approx_values, which must not be empty.
+    static std::string formatStateMessage(const std::vector<double>& approx_values);
 
- private:
-    int point;
-    double value;
+    // Returns whether string is alphanumeric.
+    static bool isAlphanumeric(std::string_view str);
 
-    // Does not check if point and value are in correct range.
-    bool parseMessage() override;
-};
+    // Returns whether string is a valid integer.
+    // If it is, saves it to out_val.
+    static bool parseInteger(std::string_view str, int& out_val);
 
-class StateMessage : public Message {
- public:
-    static std::unique_ptr<Message> createMessage(const std::vector<double>& approx_values);
-    const std::vector<double>& getApproxValues() const { return approx_values; }
+    // Returns whether string is a valid double.
+    // If it is, saves it to out_val.
+    static bool parseDouble(std::string_view str, double& out_val);
 
- private:
-    std::vector<double> approx_values;
+    // Divides string into command and parameters.
+    // On success, saves command and parameters to out_command and out_params, returning true.
+    static bool extractCommandAndParams(std::string_view line, std::string_view& out_command,
+                                        std::string_view& out_params);
 
-    // Does not check if values are correct nor if there is correct number of them
-    bool parseMessage() override;
-};
+    // Splits parameters separated by single spaces, each made of letters, digits, '-' and '.'.
+    // On success, saves views of the parameters to out_params, returning true.
+    static bool splitParams(std::string_view params, ParamList& out_params);
 
-class PenaltyMessage : public Message {
- public:
-    static std::unique_ptr<Message> createMessage(int point, double value);
-    int getPoint() const { return point; }
-    double getValue() const { return value; }
+    // Validates whether parameters are a valid integer and double pair.
+    // If they are, saves them to out_point and out_value, returning true.
+    static bool validateIntDoublePair(const ParamList& params, int& out_point,
+                                      double& out_value);
 
- private:
-    int point;
-    double value;
+    // Converts double to string with precision constants::max_fractional_digits.
+    static std::string doubleToString(double val);
 
-    // Does not check if point and value are in correct range.
-    bool parseMessage() override;
-};
+    // Upper bound of the length of formatDouble() output for values with absolute value at
+    // most max_abs.
+    static size_t formattedDoubleLength(double max_abs);
 
-class ScoringMessage : public Message {
- public:
-    static std::unique_ptr<Message> createMessage(const std::vector<std::string>& player_ids,
-                                                  const std::vector<double>& scores);
-    const std::vector<std::string>& getPlayerIds() const { return player_ids; }
-    const std::vector<double>& getScores() const { return scores; }
+    // Writes val with precision constants::max_fractional_digits into [first, last), the same
+    // way as doubleToString() but without allocating. The buffer must be large enough
+    // (see formattedDoubleLength()). Returns the end of the written characters.
+    static char* formatDouble(double val, char* first, char* last);
 
  private:
-    std::vector<std::string> player_ids;
-    std::vector<double> scores;
+    static bool isValidIntegerStringFormat(std::string_view str);
+    static bool isValidDoubleStringFormat(std::string_view str);
+
+    static bool parseParams(const ParamList& params, HelloMessage& out_msg);
+    static bool parseParams(const ParamList& params, CoeffMessage& out_msg);
+    static bool parseParams(const ParamList& params, StateMessage& out_msg);
+    static bool parseParams(const ParamList& params, ScoringMessage& out_msg);
+    static bool parseParams(const ParamList& params, WindowMessage& out_msg);
+    // PUT, BAD_PUT, STATE_DELTA and PENALTY.
+    template <typename T>
+    static bool parseParams(const ParamList& params, T& out_msg) {
+        return validateIntDoublePair(params, out_msg.point, out_msg.value);
+    }
 
-    bool parseMessage() override;
+    // Returns "command point value" with CRLF.
+    static std::string formatIntDoublePair(std::string_view command, int point, double value);
 };
 
-#endif // MSG_PARSER_H
\ No newline at end of file
+#endif // MSG_PARSER_H
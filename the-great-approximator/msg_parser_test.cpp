@@ -0,0 +1,263 @@
+// The tokenizer, the number parsers and the formatting of MessageParser against the regex,
+// stoll/stod and stringstream based versions they replaced, on generated input, and
+// parseMessage() on edge cases of the protocol.
+
+#include <cmath>
+#include <iomanip>
+#include <ios>
+#include <limits>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "constants.h"
+#include "msg_parser.h"
+#include "test.h"
+
+namespace {
+
+constexpr int generated_cases = 30000;
+
+// The splitter used before the tokenizer.
+bool reference_split_params(const std::string& params, std::vector<std::string>& out_vec) {
+    out_vec.clear();
+    if (params.empty()) {
+        return true;
+    }
+
+    static const std::regex params_regex("([a-zA-Z0-9\\-\\.]+ )*[a-zA-Z0-9\\-\\.]+");
+    if (!std::regex_match(params, params_regex)) {
+        return false;
+    }
+
+    std::istringstream iss(params);
+    std::string param;
+    while (iss >> param) {
+        out_vec.push_back(param);
+    }
+    return true;
+}
+
+bool reference_parse_integer(const std::string& str, int& out_val) {
+    if (str.empty() || str == "-" ||
+        str.find_first_not_of("0123456789", str.front() == '-' ? 1 : 0) != std::string::npos) {
+        return false;
+    }
+    try {
+        size_t processed_chars = 0;
+        long long temp_val = std::stoll(str, &processed_chars);
+        if (processed_chars != str.length() || temp_val < std::numeric_limits<int>::min() ||
+            temp_val > std::numeric_limits<int>::max()) {
+            return false;
+        }
+        out_val = static_cast<int>(temp_val);
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool reference_parse_double(const std::string& str, double& out_val) {
+    static const std::regex format("-?([0-9]+\\.?[0-9]{0," +
+                                   std::to_string(constants::max_fractional_digits) +
+                                   "}|\\.[0-9]{1," +
+                                   std::to_string(constants::max_fractional_digits) + "})");
+    if (!std::regex_match(str, format)) {
+        return false;
+    }
+    try {
+        size_t processed_chars = 0;
+        out_val = std::stod(str, &processed_chars);
+        return processed_chars == str.length();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// The formatting used before std::to_chars.
+std::string reference_double_to_string(double val) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(constants::max_fractional_digits) << val;
+    return ss.str();
+}
+
+std::string reference_state(const std::vector<double>& approx_values) {
+    std::string approx_values_str = "";
+    for (const auto& approx_value : approx_values) {
+        approx_values_str += reference_double_to_string(approx_value) + " ";
+    }
+    approx_values_str.pop_back();
+    return "STATE " + approx_values_str + constants::crlf;
+}
+
+// Strings mostly made of characters allowed in parameters, with occasional invalid ones.
+std::string random_string(std::mt19937_64& rng, const std::string& alphabet, size_t max_length) {
+    std::string str(rng() % (max_length + 1), ' ');
+    for (char& c : str) {
+        c = alphabet[rng() % alphabet.size()];
+    }
+    return str;
+}
+
+void test_split_params(std::mt19937_64& rng) {
+    const std::string alphabet = "aZ09-. .  _,\t";
+    std::vector<std::string> expected;
+    ParamList params;
+    for (int i = 0; i < generated_cases; i++) {
+        std::string line = random_string(rng, alphabet, 24);
+        bool expected_ok = reference_split_params(line, expected);
+        bool ok = MessageParser::splitParams(line, params);
+        CHECK(ok == expected_ok);
+        if (ok && expected_ok) {
+            CHECK(params.size() == expected.size());
+            for (size_t j = 0; j < params.size() && j < expected.size(); j++) {
+                CHECK(params[j] == expected[j]);
+            }
+        }
+    }
+
+    // More parameters than are stored inline.
+    std::string state = "1";
+    for (int i = 2; i <= 100; i++) {
+        state += " " + std::to_string(i);
+    }
+    CHECK(MessageParser::splitParams(state, params));
+    CHECK(params.size() == 100);
+    CHECK(params[0] == "1" && params[ParamList::inline_capacity] == "10" && params[99] == "100");
+}
+
+void test_parse_numbers(std::mt19937_64& rng) {
+    const std::string alphabet = "0123456789-.0123456789";
+    for (int i = 0; i < generated_cases; i++) {
+        std::string str = random_string(rng, alphabet, 14);
+
+        int expected_int = 0, parsed_int = 0;
+        bool expected_ok = reference_parse_integer(str, expected_int);
+        CHECK(MessageParser::parseInteger(str, parsed_int) == expected_ok);
+        CHECK(!expected_ok || parsed_int == expected_int);
+
+        double expected_double = 0.0, parsed_double = 0.0;
+        expected_ok = reference_parse_double(str, expected_double);
+        CHECK(MessageParser::parseDouble(str, parsed_double) == expected_ok);
+        CHECK(!expected_ok || parsed_double == expected_double);
+    }
+
+    int value = 0;
+    CHECK(MessageParser::parseInteger("2147483647", value) && value == 2147483647);
+    CHECK(MessageParser::parseInteger("-2147483648", value) && value == -2147483647 - 1);
+    CHECK(!MessageParser::parseInteger("2147483648", value));
+    CHECK(!MessageParser::parseInteger("+1", value));
+    CHECK(!MessageParser::parseInteger("", value));
+
+    double real = 0.0;
+    CHECK(MessageParser::parseDouble("-1.1234567", real) && real == -1.1234567);
+    CHECK(MessageParser::parseDouble(".5", real) && real == 0.5);
+    CHECK(MessageParser::parseDouble("5.", real) && real == 5.0);
+    CHECK(!MessageParser::parseDouble("1.12345678", real)); // max_fractional_digits
+    CHECK(!MessageParser::parseDouble("1e3", real));
+    CHECK(!MessageParser::parseDouble("-", real));
+    CHECK(!MessageParser::parseDouble(".", real));
+    CHECK(!MessageParser::parseDouble(std::string(400, '9'), real)); // out of range
+}
+
+void test_parse_message() {
+    Message msg;
+
+    CHECK(MessageParser::parseMessage("PUT 42 -1.5", msg));
+    CHECK(std::holds_alternative<PutMessage>(msg) && std::get<PutMessage>(msg).point == 42 &&
+          std::get<PutMessage>(msg).value == -1.5);
+    CHECK(!MessageParser::parseMessage("PUT 42  -1.5", msg));
+    CHECK(!MessageParser::parseMessage("PUT 42 -1.5 ", msg));
+    CHECK(!MessageParser::parseMessage(" PUT 42 -1.5", msg));
+    CHECK(!MessageParser::parseMessage("PUT 42", msg));
+    CHECK(!MessageParser::parseMessage("PUT 42 1 2", msg));
+    CHECK(!MessageParser::parseMessage("PUT 4.2 1", msg));
+    CHECK(!MessageParser::parseMessage("PUT ", msg));
+    CHECK(!MessageParser::parseMessage("", msg));
+    CHECK(!MessageParser::parseMessage("put 42 1", msg));
+
+    CHECK(MessageParser::parseMessage("HELLO Player1", msg));
+    CHECK(std::get<HelloMessage>(msg).player_id == "Player1" &&
+          !std::get<HelloMessage>(msg).state_delta && std::get<HelloMessage>(msg).window == 0 &&
+          std::get<HelloMessage>(msg).room == -1);
+    CHECK(MessageParser::parseMessage("HELLO p DELTA WINDOW 8 ROOM 3", msg));
+    CHECK(std::get<HelloMessage>(msg).state_delta && std::get<HelloMessage>(msg).window == 8 &&
+          std::get<HelloMessage>(msg).room == 3);
+    CHECK(!MessageParser::parseMessage("HELLO p-1", msg)); // ids are alphanumeric
+    CHECK(!MessageParser::parseMessage("HELLO p.1", msg));
+    CHECK(!MessageParser::parseMessage("HELLO p_1", msg));
+    CHECK(!MessageParser::parseMessage("HELLO p DELTA DELTA", msg));
+    CHECK(!MessageParser::parseMessage("HELLO p WINDOW 0", msg));
+    CHECK(!MessageParser::parseMessage("HELLO p ROOM 1 DELTA", msg));
+    CHECK(!MessageParser::parseMessage("HELLO p ROOM -1", msg));
+
+    std::string coeff = "COEFF";
+    for (size_t i = 0; i <= constants::max_n; i++) {
+        coeff += " 1.5";
+    }
+    CHECK(MessageParser::parseMessage(coeff, msg));
+    CHECK(std::get<CoeffMessage>(msg).coeffs.size() == constants::max_n + 1);
+    CHECK(!MessageParser::parseMessage(coeff + " 1.5", msg));
+
+    // Every message formatted by the server parses back to the same values.
+    std::vector<double> state = {0.0, -1.25, 3.5, 1234.1234567};
+    std::string state_line = MessageParser::formatStateMessage(state);
+    state_line.resize(state_line.size() - constants::crlf.size());
+    CHECK(MessageParser::parseMessage(state_line, msg));
+    CHECK(std::get<StateMessage>(msg).approx_values == state);
+    for (const Message& original :
+         {Message(PenaltyMessage{7, 2.5}), Message(BadPutMessage{-3, -0.0000001}),
+          Message(StateDeltaMessage{0, 100.25}), Message(WindowMessage{16})}) {
+        std::string line = MessageParser::formatMessage(original);
+        line.resize(line.size() - constants::crlf.size());
+        CHECK(MessageParser::parseMessage(line, msg));
+        CHECK(msg.index() == original.index());
+        CHECK(MessageParser::formatMessage(msg) == MessageParser::formatMessage(original));
+    }
+}
+
+void test_format_doubles(std::mt19937_64& rng) {
+    // Rounding corner cases and the range of values seen in games.
+    std::vector<double> values = {0.0,        -0.0,        5.0,         -5.0,
+                                  0.00000005, 0.00000015,  -0.00000005, 0.12345675,
+                                  1e-8,       -1e-8,       123456789.0, 1e15,
+                                  -1e300,     9.99999995,  0.1,         1.0 / 3.0};
+    std::uniform_real_distribution<double> wide(-1e7, 1e7);
+    std::uniform_int_distribution<int> fixed_point(-50000000, 50000000);
+    for (int i = 0; i < generated_cases; i++) {
+        values.push_back(wide(rng));
+        values.push_back(fixed_point(rng) / 1e7); // exactly what sums of puts look like
+    }
+
+    for (double value : values) {
+        std::string expected = reference_double_to_string(value);
+        CHECK(MessageParser::doubleToString(value) == expected);
+        CHECK(MessageParser::formattedDoubleLength(std::abs(value)) >= expected.size());
+    }
+    CHECK(MessageParser::formatStateMessage(values) == reference_state(values));
+}
+
+void test_format_state(std::mt19937_64& rng) {
+    std::vector<double> state(constants::max_k + 1);
+    std::uniform_int_distribution<int> put(-50000000, 50000000);
+    for (double& value : state) {
+        value = put(rng) / 1e7 * (1 + rng() % 4);
+    }
+    CHECK(MessageParser::formatStateMessage(state) == reference_state(state));
+    CHECK(MessageParser::formatStateMessage({-0.0}) == reference_state({-0.0}));
+}
+
+} // namespace
+
+void test_msg_parser() {
+    std::mt19937_64 rng(2024);
+    test_split_params(rng);
+    test_parse_numbers(rng);
+    test_parse_message();
+    test_format_doubles(rng);
+    test_format_state(rng);
+}
@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstring>
 #include <string>
 
@@ -15,7 +16,7 @@
 namespace {
 
 // Tries to set up ipv6 socket, returns false on error.
-bool setup_listening_socket_ipv6(uint16_t port, int backlog, int& sockfd) {
+bool setup_listening_socket_ipv6(uint16_t port, int backlog, bool reuse_port, int& sockfd) {
     sockfd = socket(AF_INET6, SOCK_STREAM, 0);
 
     if (sockfd < 0) {
@@ -29,6 +30,11 @@ bool setup_listening_socket_ipv6(uint16_t port, int backlog, int& sockfd) {
         error_msg += "Enabling SO_REUSEADDR failed\n";
     }
 
+    if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(sockfd);
+        return false;
+    }
+
     opt = 0;
     if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)) < 0) {
         error_msg += "Disabling IPV6_V6ONLY failed\n";
@@ -41,6 +47,7 @@ bool setup_listening_socket_ipv6(uint16_t port, int backlog, int& sockfd) {
     addr.sin6_port = htons(port);
 
     if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sockfd);
         return false;
     }
 
@@ -56,7 +63,7 @@ bool setup_listening_socket_ipv6(uint16_t port, int backlog, int& sockfd) {
 }
 
 // Tries to set up ipv4 socket, exits on error, returns socket file descriptor.
-int setup_listening_socket_ipv4(uint16_t port, int backlog) {
+int setup_listening_socket_ipv4(uint16_t port, int backlog, bool reuse_port) {
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         syserr("socket");
@@ -67,6 +74,10 @@ int setup_listening_socket_ipv4(uint16_t port, int backlog) {
         error("Setting SO_REUSEADDR failed");
     }
 
+    if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        syserr("Setting SO_REUSEPORT failed");
+    }
+
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
@@ -87,10 +98,9 @@ int setup_listening_socket_ipv4(uint16_t port, int backlog) {
     return sockfd;
 }
 
-} // namespace
-
-int connect_to_server(const std::string& host, const std::string& port_str, bool force_ipv4,
-                      bool force_ipv6, std::string& out_server_ip, int& out_server_port) {
+// Resolves host and port into a list of TCP addresses, exits on error.
+struct addrinfo* resolve(const std::string& host, const std::string& port_str, bool force_ipv4,
+                         bool force_ipv6) {
     struct addrinfo hints;
 
     memset(&hints, 0, sizeof(hints));
@@ -110,6 +120,14 @@ int connect_to_server(const std::string& host, const std::string& port_str, bool
         fatal("getaddrinfo for host '%s' port '%s' failed: %s", host.c_str(), port_str.c_str(),
               gai_strerror(gai_ret));
     }
+    return res;
+}
+
+} // namespace
+
+int connect_to_server(const std::string& host, const std::string& port_str, bool force_ipv4,
+                      bool force_ipv6, std::string& out_server_ip, int& out_server_port) {
+    struct addrinfo* res = resolve(host, port_str, force_ipv4, force_ipv6);
 
     struct addrinfo* send_addr;
     int sockfd = -1;
@@ -154,6 +172,40 @@ int connect_to_server(const std::string& host, const std::string& port_str, bool
     return sockfd;
 }
 
+void resolve_server_address(const std::string& host, const std::string& port_str,
+                            bool force_ipv4, bool force_ipv6, struct sockaddr_storage* out_addr,
+                            socklen_t* out_addr_len) {
+    struct addrinfo* res = resolve(host, port_str, force_ipv4, force_ipv6);
+    memcpy(out_addr, res->ai_addr, res->ai_addrlen);
+    *out_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+}
+
+int start_connecting(const struct sockaddr_storage* addr, socklen_t addr_len) {
+    int sockfd = socket(addr->ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (sockfd < 0) {
+        return -1;
+    }
+    set_socket_nonblocking(sockfd);
+
+    if (connect(sockfd, (const struct sockaddr*)addr, addr_len) < 0 && errno != EINPROGRESS) {
+        int saved_errno = errno;
+        close(sockfd);
+        errno = saved_errno;
+        return -1;
+    }
+    return sockfd;
+}
+
+int get_socket_error(int sockfd) {
+    int socket_error = 0;
+    socklen_t length = sizeof(socket_error);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &socket_error, &length) < 0) {
+        return errno;
+    }
+    return socket_error;
+}
+
 void set_receive_timeout(int sockfd, int timeout_ms) {
     struct timeval tv;
     tv.tv_sec = timeout_ms / 1000;
@@ -163,28 +215,76 @@ void set_receive_timeout(int sockfd, int timeout_ms) {
     }
 }
 
-int setup_listening_socket(uint16_t port, int backlog) {
+int setup_listening_socket(uint16_t port, int backlog, bool reuse_port) {
     int sockfd = -1;
-    if (setup_listening_socket_ipv6(port, backlog, sockfd)) {
+    if (setup_listening_socket_ipv6(port, backlog, reuse_port, sockfd)) {
         return sockfd;
     }
-    return setup_listening_socket_ipv4(port, backlog);
+    return setup_listening_socket_ipv4(port, backlog, reuse_port);
+}
+
+uint16_t get_local_port(int sockfd) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(sockfd, (struct sockaddr*)&addr, &addr_len) < 0) {
+        syserr("getsockname");
+    }
+    if (addr.ss_family == AF_INET) {
+        return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+    }
+    return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
 }
 
 int accept_new_connection(int listening_fd, struct sockaddr_storage* client_addr,
                           socklen_t* client_addr_len) {
-    int client_fd = accept(listening_fd, (struct sockaddr*)client_addr, client_addr_len);
-    if (client_fd < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // No pending connections
-            return -1;
+    socklen_t addr_len = *client_addr_len;
+    while (true) {
+        *client_addr_len = addr_len;
+        int client_fd = accept4(listening_fd, (struct sockaddr*)client_addr, client_addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd >= 0) {
+            return client_fd;
+        }
+
+        switch (errno) {
+            case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
+                // No pending connections
+                errno = 0;
+                return -1;
+            case EINTR:
+            case ECONNABORTED: // closed by the client before it was accepted
+            case EPROTO:
+                continue;
+            case EMFILE:
+            case ENFILE:
+            case ENOBUFS:
+            case ENOMEM: return -1;
+            default: syserr("Error accepting connection");
         }
-        syserr("Error accepting connection");
     }
+}
 
-    set_socket_nonblocking(client_fd);
+std::string get_address_ip(const struct sockaddr_storage& addr) {
+    char ip_str[INET6_ADDRSTRLEN]; // enough for IPv4 and IPv6
+    const char* result;
+    if (addr.ss_family == AF_INET) {
+        result = inet_ntop(AF_INET, &((const struct sockaddr_in*)&addr)->sin_addr, ip_str,
+                           sizeof(ip_str));
+    } else {
+        result = inet_ntop(AF_INET6, &((const struct sockaddr_in6*)&addr)->sin6_addr, ip_str,
+                           sizeof(ip_str));
+    }
+    return result ? std::string(result) : std::string("?");
+}
 
-    return client_fd;
+int get_address_port(const struct sockaddr_storage& addr) {
+    if (addr.ss_family == AF_INET) {
+        return ntohs(((const struct sockaddr_in*)&addr)->sin_port);
+    }
+    return ntohs(((const struct sockaddr_in6*)&addr)->sin6_port);
 }
 
 void set_socket_nonblocking(int sockfd) {
@@ -11,15 +11,35 @@
 int connect_to_server(const std::string& host, const std::string& port_str, bool force_ipv4,
                       bool force_ipv6, std::string& out_server_ip, int& out_server_port);
 
+// Resolves the server address the same way as connect_to_server(), without connecting.
+// The first address found is saved to out_addr. Exits on error.
+void resolve_server_address(const std::string& host, const std::string& port_str,
+                            bool force_ipv4, bool force_ipv6, struct sockaddr_storage* out_addr,
+                            socklen_t* out_addr_len);
+
+// Creates a non-blocking socket and starts connecting it to addr.
+// The connection is established, or has failed (see get_socket_error()), once the socket
+// becomes writable. Returns the socket, or -1 with errno set if connecting failed at once.
+int start_connecting(const struct sockaddr_storage* addr, socklen_t addr_len);
+
+// Returns the pending error of a socket (SO_ERROR), 0 if there is none.
+int get_socket_error(int sockfd);
+
 // Sets the receive timeout for a socket.
 void set_receive_timeout(int sockfd, int timeout_ms);
 
-// Accepts a new connection from the listening socket.
+// Accepts a new connection from the listening socket, already non-blocking and
+// close-on-exec. Connections aborted by their clients before they were accepted are skipped.
 // Returns the client socket file descriptor.
-// If there are no pending connections, returns -1.
+// If there are no pending connections, returns -1 with errno 0. If the connection cannot be
+// accepted for lack of descriptors or memory, returns -1 with errno set; it stays pending.
 int accept_new_connection(int listening_fd, struct sockaddr_storage* client_addr,
                           socklen_t* client_addr_len);
 
+// Return the IP address (as text) and the port of an IPv4 or IPv6 socket address.
+std::string get_address_ip(const struct sockaddr_storage& addr);
+int get_address_port(const struct sockaddr_storage& addr);
+
 // Sets the socket to non-blocking mode.
 void set_socket_nonblocking(int sockfd);
 
@@ -28,6 +48,11 @@ void set_socket_nonblocking(int sockfd);
 // Sets the socket to non-blocking mode and starts listening for connections.
 // Returns the listening socket file descriptor.
 // Backlog is the maximum number of pending connections.
-int setup_listening_socket(uint16_t port, int backlog);
+// With reuse_port, SO_REUSEPORT is set, so that several sockets can listen on the same port
+// and the kernel spreads incoming connections between them.
+int setup_listening_socket(uint16_t port, int backlog, bool reuse_port = false);
+
+// Returns the port a socket is bound to (useful after binding to port 0).
+uint16_t get_local_port(int sockfd);
 
 #endif // NETWORKING_H
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "output_queue.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+OutputQueue::OutputQueue(OutputQueue&& other) noexcept
+    : chunks(std::move(other.chunks)),
+      head_offset(other.head_offset),
+      queued_bytes(other.queued_bytes),
+      gauge(other.gauge) {
+    other.chunks.clear();
+    other.head_offset = 0;
+    other.queued_bytes = 0;
+}
+
+OutputQueue& OutputQueue::operator=(OutputQueue&& other) noexcept {
+    if (this != &other) {
+        clear();
+        chunks = std::move(other.chunks);
+        head_offset = other.head_offset;
+        queued_bytes = other.queued_bytes;
+        gauge = other.gauge;
+        other.chunks.clear();
+        other.head_offset = 0;
+        other.queued_bytes = 0;
+    }
+    return *this;
+}
+
+void OutputQueue::set_gauge(OutputMemoryGauge* new_gauge) {
+    if (gauge) {
+        gauge->sub(queued_bytes);
+    }
+    gauge = new_gauge;
+    if (gauge) {
+        gauge->add(queued_bytes);
+    }
+}
+
+void OutputQueue::push(std::string msg) {
+    if (msg.empty()) {
+        return;
+    }
+    queued_bytes += msg.size();
+    if (gauge) {
+        gauge->add(msg.size());
+    }
+    // Small messages are appended to the last chunk, so that a flood of them (e.g. PENALTY)
+    // does not cost much more memory than the bytes themselves.
+    if (!chunks.empty() && !chunks.back().shared &&
+        chunks.back().owned.size() + msg.size() <= coalesce_size) {
+        chunks.back().owned += msg;
+        return;
+    }
+    chunks.push_back({std::move(msg), nullptr});
+}
+
+void OutputQueue::push(std::shared_ptr<const std::string> msg) {
+    if (!msg || msg->empty()) {
+        return;
+    }
+    queued_bytes += msg->size();
+    if (gauge) {
+        gauge->add(msg->size());
+    }
+    chunks.push_back({std::string(), std::move(msg)});
+}
+
+OutputQueue::FlushResult OutputQueue::flush(int fd, size_t budget) {
+    struct iovec iov[max_iov];
+
+    while (!chunks.empty()) {
+        if (budget == 0) {
+            return FlushResult::BUDGET;
+        }
+
+        int iov_count = 0;
+        size_t requested = 0;
+        size_t offset = head_offset;
+        for (const Chunk& chunk : chunks) {
+            if (iov_count == max_iov || requested >= budget) {
+                break;
+            }
+            const std::string& data = chunk.data();
+            iov[iov_count].iov_base = const_cast<char*>(data.data() + offset);
+            iov[iov_count].iov_len = data.size() - offset;
+            requested += iov[iov_count].iov_len;
+            iov_count++;
+            offset = 0;
+        }
+
+        struct msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+
+        // MSG_NOSIGNAL: a client that went away must not kill the server with SIGPIPE.
+        ssize_t bytes_written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (bytes_written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = 0;
+                return FlushResult::BLOCKED;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            return FlushResult::ERROR;
+        }
+
+        consume(bytes_written);
+        budget -= std::min<size_t>(bytes_written, budget);
+
+        if ((size_t)bytes_written < requested) {
+            return FlushResult::BLOCKED; // socket buffer is full
+        }
+    }
+
+    return FlushResult::DONE;
+}
+
+void OutputQueue::consume(size_t count) {
+    queued_bytes -= count;
+    if (gauge) {
+        gauge->sub(count);
+    }
+    while (count > 0) {
+        size_t left_in_chunk = chunks.front().data().size() - head_offset;
+        if (count < left_in_chunk) {
+            head_offset += count;
+            return;
+        }
+        count -= left_in_chunk;
+        chunks.pop_front();
+        head_offset = 0;
+    }
+}
+
+void OutputQueue::clear() {
+    if (gauge) {
+        gauge->sub(queued_bytes);
+    }
+    chunks.clear();
+    head_offset = 0;
+    queued_bytes = 0;
+}
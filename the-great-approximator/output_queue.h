@@ -0,0 +1,92 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+
+// Number of bytes held by a group of output queues, and the largest number ever held.
+// Updated by a single thread, may be read by any.
+class OutputMemoryGauge {
+ public:
+    void add(size_t bytes) {
+        size_t now = current.load(std::memory_order_relaxed) + bytes;
+        current.store(now, std::memory_order_relaxed);
+        if (now > peak.load(std::memory_order_relaxed)) {
+            peak.store(now, std::memory_order_relaxed);
+        }
+    }
+
+    void sub(size_t bytes) {
+        current.store(current.load(std::memory_order_relaxed) - bytes,
+                      std::memory_order_relaxed);
+    }
+
+    size_t getCurrent() const { return current.load(std::memory_order_relaxed); }
+    size_t getPeak() const { return peak.load(std::memory_order_relaxed); }
+
+ private:
+    std::atomic<size_t> current{0};
+    std::atomic<size_t> peak{0};
+};
+
+// Outgoing messages of a connection, written with as few system calls as possible.
+// Queued messages are sent together with vectored writes; a partially sent message stays
+// in place and only the offset of its unsent part is remembered.
+class OutputQueue {
+ public:
+    enum class FlushResult {
+        DONE,    // everything was sent
+        BLOCKED, // the socket buffer is full, wait until it is writable
+        BUDGET,  // budget was used up, flush again later
+        ERROR,   // the connection is broken, errno is set
+    };
+
+    OutputQueue() = default;
+    ~OutputQueue() { clear(); }
+    // Moving transfers the messages together with the gauge they are counted in.
+    OutputQueue(OutputQueue&& other) noexcept;
+    OutputQueue& operator=(OutputQueue&& other) noexcept;
+
+    // Counts the queued bytes in gauge from now on (nullptr: not counted anywhere).
+    void set_gauge(OutputMemoryGauge* new_gauge);
+
+    void push(std::string msg);
+
+    // Queues a message shared with other connections (e.g. SCORING) without copying it.
+    void push(std::shared_ptr<const std::string> msg);
+
+    bool empty() const { return chunks.empty(); }
+
+    // Number of bytes waiting to be sent.
+    size_t size() const { return queued_bytes; }
+
+    // Sends queued messages until the queue is empty, the socket would block, or about
+    // budget bytes were sent.
+    FlushResult flush(int fd, size_t budget);
+
+    void clear();
+
+ private:
+    // Messages are either owned or shared; shared is used when set.
+    struct Chunk {
+        std::string owned;
+        std::shared_ptr<const std::string> shared;
+
+        const std::string& data() const { return shared ? *shared : owned; }
+    };
+
+    static constexpr int max_iov = 64;
+    static constexpr size_t coalesce_size = 4096;
+
+    std::deque<Chunk> chunks;
+    size_t head_offset = 0; // bytes of the first chunk already sent
+    size_t queued_bytes = 0;
+    OutputMemoryGauge* gauge = nullptr;
+
+    void consume(size_t count);
+};
+
+#endif // OUTPUT_QUEUE_H
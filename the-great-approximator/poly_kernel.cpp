@@ -0,0 +1,79 @@
+#include "poly_kernel.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+#include "constants.h"
+
+namespace {
+
+// Horner's rule for a polynomial of known degree, the loop is unrolled by the compiler.
+template <size_t Degree>
+double horner(const double* coefficients, double x) {
+    double result = coefficients[Degree];
+    for (size_t i = Degree; i-- > 0;) {
+        result = result * x + coefficients[i];
+    }
+    return result;
+}
+
+template <size_t Degree>
+void fill_values(const double* coefficients, int max_x, double* out) {
+    int x = 0;
+#ifdef __SSE2__
+    // Two points per iteration; multiplication and addition are rounded separately, exactly
+    // like in the scalar version.
+    __m128d xs = _mm_set_pd(1.0, 0.0);
+    const __m128d step = _mm_set1_pd(2.0);
+    for (; x < max_x; x += 2) {
+        __m128d result = _mm_set1_pd(coefficients[Degree]);
+        for (size_t i = Degree; i-- > 0;) {
+            result = _mm_add_pd(_mm_mul_pd(result, xs), _mm_set1_pd(coefficients[i]));
+        }
+        _mm_storeu_pd(out + x, result);
+        xs = _mm_add_pd(xs, step);
+    }
+#endif
+    for (; x <= max_x; x++) {
+        out[x] = horner<Degree>(coefficients, x);
+    }
+}
+
+using FillFunction = void (*)(const double*, int, double*);
+
+template <size_t... Degrees>
+constexpr std::array<FillFunction, sizeof...(Degrees)> make_fill_functions(
+    std::index_sequence<Degrees...>) {
+    return {&fill_values<Degrees>...};
+}
+
+// fill_functions[d] evaluates polynomials of degree d.
+constexpr std::array<FillFunction, constants::max_n + 1> fill_functions =
+    make_fill_functions(std::make_index_sequence<constants::max_n + 1>());
+
+} // namespace
+
+double poly_value_at(const std::vector<double>& coefficients, int x) {
+    double result = 0.0;
+    for (size_t i = coefficients.size(); i-- > 0;) {
+        result = result * x + coefficients[i];
+    }
+    return result;
+}
+
+void fill_poly_values(const std::vector<double>& coefficients, int max_x,
+                      std::vector<double>& out_values) {
+    out_values.resize(max_x + 1);
+    if (coefficients.empty() || coefficients.size() > fill_functions.size()) {
+        for (int x = 0; x <= max_x; x++) {
+            out_values[x] = poly_value_at(coefficients, x);
+        }
+        return;
+    }
+    fill_functions[coefficients.size() - 1](coefficients.data(), max_x, out_values.data());
+}
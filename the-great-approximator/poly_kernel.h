@@ -0,0 +1,17 @@
+#ifndef POLY_KERNEL_H
+#define POLY_KERNEL_H
+
+#include <vector>
+
+// Evaluation of the polynomials of the game; coefficients[i] is the coefficient of x^i.
+// Both functions use Horner's rule, so a value does not depend on which one computed it.
+
+// Returns the value of the polynomial at x.
+double poly_value_at(const std::vector<double>& coefficients, int x);
+
+// Saves the values of the polynomial at x = 0, 1, ..., max_x to out_values.
+// Specialized for every degree up to constants::max_n, evaluates two points at a time.
+void fill_poly_values(const std::vector<double>& coefficients, int max_x,
+                      std::vector<double>& out_values);
+
+#endif // POLY_KERNEL_H
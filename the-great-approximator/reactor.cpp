@@ -0,0 +1,172 @@
+#include "reactor.h"
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <vector>
+
+#include "err.h"
+
+namespace {
+
+// Level-triggered reactor based on poll().
+// Keeps an fd -> index table, so that removal is a swap with the last entry.
+class PollReactor : public Reactor {
+ public:
+    PollReactor() : poll_fds(), index_of_fd(), ready() {}
+
+    void add(int fd, bool want_write) override {
+        if (fd >= (int)index_of_fd.size()) {
+            index_of_fd.resize(fd + 1, -1);
+        }
+        index_of_fd[fd] = poll_fds.size();
+        poll_fds.push_back({fd, (short)(POLLIN | (want_write ? POLLOUT : 0)), 0});
+    }
+
+    void set_write_interest(int fd, bool enabled) override {
+        struct pollfd& pfd = poll_fds[index_of_fd[fd]];
+        if (enabled) {
+            pfd.events |= POLLOUT;
+        } else {
+            pfd.events &= ~POLLOUT;
+        }
+    }
+
+    void set_read_interest(int fd, bool enabled) override {
+        struct pollfd& pfd = poll_fds[index_of_fd[fd]];
+        if (enabled) {
+            pfd.events |= POLLIN;
+        } else {
+            pfd.events &= ~POLLIN;
+        }
+    }
+
+    void remove(int fd) override {
+        int idx = index_of_fd[fd];
+        int last_fd = poll_fds.back().fd;
+        poll_fds[idx] = poll_fds.back();
+        index_of_fd[last_fd] = idx;
+        poll_fds.pop_back();
+        index_of_fd[fd] = -1;
+    }
+
+    const std::vector<ReadyEvent>& wait(int timeout_ms) override {
+        ready.clear();
+        int ready_count = poll(poll_fds.data(), poll_fds.size(), timeout_ms);
+        if (ready_count < 0) {
+            if (errno == EINTR) {
+                return ready;
+            }
+            syserr("poll");
+        }
+
+        for (size_t i = 0; i < poll_fds.size() && (int)ready.size() < ready_count; i++) {
+            short revents = poll_fds[i].revents;
+            if (revents == 0) {
+                continue;
+            }
+            uint32_t events = 0;
+            if (revents & POLLIN) {
+                events |= reactor_events::readable;
+            }
+            if (revents & POLLOUT) {
+                events |= reactor_events::writable;
+            }
+            if (revents & POLLHUP) {
+                events |= reactor_events::hangup;
+            }
+            if (revents & (POLLERR | POLLNVAL)) {
+                events |= reactor_events::error;
+            }
+            ready.push_back({poll_fds[i].fd, events});
+        }
+        return ready;
+    }
+
+ private:
+    std::vector<struct pollfd> poll_fds;
+    std::vector<int> index_of_fd; // fd -> index in poll_fds, -1 if not watched
+    std::vector<ReadyEvent> ready;
+};
+
+// Edge-triggered reactor based on epoll.
+// Every fd is registered once for both directions, so interest never has to be changed.
+class EpollReactor : public Reactor {
+ public:
+    EpollReactor() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), epoll_events(max_events), ready() {
+        if (epoll_fd < 0) {
+            syserr("epoll_create1");
+        }
+    }
+
+    ~EpollReactor() override { close(epoll_fd); }
+
+    void add(int fd, bool /* want_write */) override {
+        struct epoll_event ev {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            syserr("epoll_ctl add");
+        }
+    }
+
+    void set_write_interest(int /* fd */, bool /* enabled */) override {}
+
+    // Readability is still reported, the caller ignores it while reads are disabled.
+    void set_read_interest(int /* fd */, bool /* enabled */) override {}
+
+    void remove(int fd) override {
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) < 0) {
+            syserr("epoll_ctl del");
+        }
+    }
+
+    const std::vector<ReadyEvent>& wait(int timeout_ms) override {
+        ready.clear();
+        int ready_count = epoll_wait(epoll_fd, epoll_events.data(), max_events, timeout_ms);
+        if (ready_count < 0) {
+            if (errno == EINTR) {
+                return ready;
+            }
+            syserr("epoll_wait");
+        }
+
+        for (int i = 0; i < ready_count; i++) {
+            uint32_t revents = epoll_events[i].events;
+            uint32_t events = 0;
+            if (revents & EPOLLIN) {
+                events |= reactor_events::readable;
+            }
+            if (revents & EPOLLOUT) {
+                events |= reactor_events::writable;
+            }
+            if (revents & EPOLLHUP) {
+                events |= reactor_events::hangup;
+            }
+            if (revents & EPOLLERR) {
+                events |= reactor_events::error;
+            }
+            ready.push_back({epoll_events[i].data.fd, events});
+        }
+        return ready;
+    }
+
+ private:
+    static constexpr int max_events = 256;
+
+    int epoll_fd;
+    std::vector<struct epoll_event> epoll_events;
+    std::vector<ReadyEvent> ready;
+};
+
+} // namespace
+
+std::unique_ptr<Reactor> Reactor::create(ReactorBackend backend) {
+    switch (backend) {
+        case ReactorBackend::POLL: return std::make_unique<PollReactor>();
+        case ReactorBackend::EPOLL: return std::make_unique<EpollReactor>();
+    }
+    fatal("unknown reactor backend");
+}
@@ -0,0 +1,61 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class ReactorBackend { POLL, EPOLL };
+
+inline const char* reactor_backend_name(ReactorBackend backend) {
+    switch (backend) {
+        case ReactorBackend::POLL: return "poll";
+        case ReactorBackend::EPOLL: return "epoll";
+    }
+    return "unknown";
+}
+
+// Readiness flags reported in ReadyEvent::events.
+namespace reactor_events {
+constexpr uint32_t readable = 1u << 0;
+constexpr uint32_t writable = 1u << 1;
+constexpr uint32_t hangup = 1u << 2;
+constexpr uint32_t error = 1u << 3;
+} // namespace reactor_events
+
+struct ReadyEvent {
+    int fd;
+    uint32_t events; // combination of reactor_events flags
+};
+
+// I/O readiness multiplexer driving the server main loop.
+// Registration, interest changes and removal are O(1) per file descriptor.
+// Edge-triggered backends report a change of readiness only once, so callers read, write
+// and accept until EAGAIN on every backend.
+class Reactor {
+ public:
+    virtual ~Reactor() = default;
+
+    // Starts watching fd for reading, and for writing if want_write is set.
+    virtual void add(int fd, bool want_write) = 0;
+
+    // Enables or disables write interest for a watched fd.
+    // Edge-triggered reactors always watch for writability, so for them this is a no-op.
+    virtual void set_write_interest(int fd, bool enabled) = 0;
+
+    // Enables or disables read interest for a watched fd. Hangups are reported regardless.
+    // An edge-triggered reactor does not report input that arrived while reads were
+    // disabled, so after enabling them again the caller has to read until EAGAIN.
+    virtual void set_read_interest(int fd, bool enabled) = 0;
+
+    // Stops watching fd. Must be called before fd is closed.
+    virtual void remove(int fd) = 0;
+
+    // Waits at most timeout_ms milliseconds (-1 means forever) for events.
+    // The returned vector stays valid until the next call to wait().
+    virtual const std::vector<ReadyEvent>& wait(int timeout_ms) = 0;
+
+    static std::unique_ptr<Reactor> create(ReactorBackend backend);
+};
+
+#endif // REACTOR_H
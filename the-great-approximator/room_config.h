@@ -0,0 +1,11 @@
+#ifndef ROOM_CONFIG_H
+#define ROOM_CONFIG_H
+
+// Parameters of the games played in one room.
+struct RoomConfig {
+    int K; // points are 0..K
+    int N; // degree of the polynomials, given by the coefficients file
+    int M; // correct puts of all players of the room that end a game
+};
+
+#endif // ROOM_CONFIG_H
@@ -1,22 +1,148 @@
 #include "server_events.h"
 
-#include <iostream>
+#include <algorithm>
+#include <climits>
 
-#include "server_logic.h"
+EventManager::EventManager(const GameClock& clock)
+    : clock(clock),
+      epoch(clock.now()),
+      current_tick(0),
+      scheduled_count(0),
+      slot_heads(),
+      occupied() {
+    for (TimerNode& head : slot_heads) {
+        head.prev = head.next = &head;
+    }
+}
+
+uint64_t EventManager::now_tick() const {
+    auto elapsed = clock.now() - epoch;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+void EventManager::schedule(TimerNode& node, GameClock::time_point deadline) {
+    // Rounded up, so that a timer never fires before its deadline.
+    auto ticks = std::chrono::ceil<std::chrono::milliseconds>(deadline - epoch).count();
+    node.expiry_tick = std::max<int64_t>(ticks, 0);
+    insert(node);
+    scheduled_count++;
+}
+
+void EventManager::cancel(TimerNode& node) {
+    if (node.is_scheduled()) {
+        unlink(node);
+        scheduled_count--;
+    }
+}
+
+void EventManager::insert(TimerNode& node) {
+    uint64_t expiry = std::max(node.expiry_tick, current_tick);
+    uint64_t delta = std::min(expiry - current_tick, max_delta);
+    uint64_t slot_tick = current_tick + delta;
+
+    int level = 0;
+    while (level + 1 < levels && delta >= (uint64_t(1) << ((level + 1) * level_bits))) {
+        level++;
+    }
+    int index = (slot_tick >> (level * level_bits)) & slot_mask;
 
-void EventManager::add_event(std::function<void()> callback,
-                             std::chrono::steady_clock::time_point deadline) {
-    events.insert({deadline, callback});
+    TimerNode& head = slot_heads[level * slots_per_level + index];
+    node.slot = level * slots_per_level + index;
+    node.prev = head.prev;
+    node.next = &head;
+    head.prev->next = &node;
+    head.prev = &node;
+    occupied[level][index / 64] |= uint64_t(1) << (index % 64);
+}
+
+void EventManager::unlink(TimerNode& node) {
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = node.next = nullptr;
+
+    TimerNode& head = slot_heads[node.slot];
+    if (head.next == &head) {
+        int level = node.slot / slots_per_level;
+        int index = node.slot % slots_per_level;
+        occupied[level][index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+}
+
+void EventManager::cascade(int level, int index) {
+    TimerNode& head = slot_heads[level * slots_per_level + index];
+    while (head.next != &head) {
+        TimerNode& node = *head.next;
+        unlink(node);
+        insert(node);
+    }
+}
+
+int EventManager::next_occupied(int level, int from) const {
+    for (int word = from / 64; word < bitmap_words; word++) {
+        uint64_t bits = occupied[level][word];
+        if (word == from / 64) {
+            bits &= ~uint64_t(0) << (from % 64);
+        }
+        if (bits != 0) {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
 }
 
 void EventManager::check_timers() {
-    auto now = std::chrono::steady_clock::now();
-    while (!events.empty() && events.begin()->first <= now) {
-        events.begin()->second();     // call the callback
-        events.erase(events.begin()); // remove the event
+    uint64_t now = now_tick();
+
+    while (current_tick <= now) {
+        if (scheduled_count == 0) {
+            current_tick = now + 1;
+            return;
+        }
+
+        int index = current_tick & slot_mask;
+        if (index == 0) {
+            // Start of a new round of level 0: move timers down from the upper levels.
+            for (int level = 1; level < levels; level++) {
+                int level_index = (current_tick >> (level * level_bits)) & slot_mask;
+                cascade(level, level_index);
+                if (level_index != 0) {
+                    break;
+                }
+            }
+        }
+
+        // Callbacks may schedule new timers, including ones due in this very tick.
+        TimerNode& head = slot_heads[index];
+        while (head.next != &head) {
+            TimerNode& node = *head.next;
+            unlink(node);
+            scheduled_count--;
+            node.callback(node);
+        }
+
+        // Skip empty slots, but never past the end of the round (cascading) or past now.
+        int next_index = index + 1 < slots_per_level ? next_occupied(0, index + 1) : -1;
+        uint64_t round_start = current_tick - index;
+        uint64_t next_tick = round_start + (next_index >= 0 ? next_index : slots_per_level);
+        current_tick = std::min(next_tick, now + 1);
     }
 }
 
-void EventManager::reset() {
-    events.clear();
-}
\ No newline at end of file
+int EventManager::next_timeout_ms() const {
+    if (scheduled_count == 0) {
+        return -1;
+    }
+
+    uint64_t now = now_tick();
+    if (current_tick <= now) {
+        return 0;
+    }
+
+    // Timers beyond this round are at least at the round boundary, where they are cascaded.
+    // At the boundary itself (index 0) the cascade is still to be done.
+    int index = current_tick & slot_mask;
+    int next_index = index == 0 ? 0 : next_occupied(0, index);
+    uint64_t round_start = current_tick - index;
+    uint64_t next_tick = round_start + (next_index >= 0 ? next_index : slots_per_level);
+    return std::min<uint64_t>(clock.to_real_ms(next_tick - now), INT_MAX);
+}
@@ -1,27 +1,82 @@
 #ifndef SERVER_EVENTS_H
 #define SERVER_EVENTS_H
 
+#include <array>
 #include <chrono>
-#include <functional>
-#include <map>
-#include <string>
+#include <cstdint>
 
+#include "game_clock.h"
+
+// Intrusive, cancellable timer. Owners derive from it and keep it alive (at a stable address)
+// while it is scheduled; EventManager never allocates.
+class TimerNode {
+ public:
+    using Callback = void (*)(TimerNode& node);
+
+    TimerNode() = default;
+    TimerNode(const TimerNode&) = delete;
+    TimerNode& operator=(const TimerNode&) = delete;
+
+    bool is_scheduled() const { return next != nullptr; }
+    void set_callback(Callback callback) { this->callback = callback; }
+
+ private:
+    friend class EventManager;
+
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expiry_tick = 0;
+    uint16_t slot = 0; // level * slots_per_level + index in level
+    Callback callback = nullptr;
+};
+
+// Hierarchical timing wheel with 1 ms ticks of clock.
+// Scheduling and cancelling are O(1); timers far in the future are moved to lower levels
+// once per level ("cascading") as their deadline approaches.
 class EventManager {
  public:
-    EventManager() : events() {}
+    explicit EventManager(const GameClock& clock = GameClock());
+    EventManager(const EventManager&) = delete;
+    EventManager& operator=(const EventManager&) = delete;
+
+    // Current time of the clock of the timers; deadlines are computed from it.
+    GameClock::time_point now() const { return clock.now(); }
+
+    // Schedules node to fire at deadline. The node must not be scheduled already.
+    void schedule(TimerNode& node, GameClock::time_point deadline);
 
-    // Adds an event to the event manager.
-    void add_event(std::function<void()> callback,
-                   std::chrono::steady_clock::time_point deadline);
+    // Unschedules node. Does nothing if it is not scheduled.
+    void cancel(TimerNode& node);
 
     // Calls all events that are due.
     void check_timers();
 
-    // Resets the event manager.
-    void reset();
+    // Returns how many real milliseconds the caller may sleep before calling check_timers(),
+    // or -1 if nothing is scheduled.
+    int next_timeout_ms() const;
 
  private:
-    std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> events;
+    static constexpr int levels = 4;
+    static constexpr int level_bits = 8;
+    static constexpr int slots_per_level = 1 << level_bits;
+    static constexpr uint64_t slot_mask = slots_per_level - 1;
+    static constexpr uint64_t max_delta = (uint64_t(1) << (levels * level_bits)) - 1;
+    static constexpr int bitmap_words = slots_per_level / 64;
+
+    GameClock clock;
+    GameClock::time_point epoch;
+    uint64_t current_tick; // next tick to be processed
+    size_t scheduled_count;
+    std::array<TimerNode, levels * slots_per_level> slot_heads; // list sentinels
+    std::array<std::array<uint64_t, bitmap_words>, levels> occupied;
+
+    uint64_t now_tick() const;
+    void insert(TimerNode& node);
+    void unlink(TimerNode& node);
+    void cascade(int level, int index);
+
+    // Returns the first non-empty slot of level in [from, slots_per_level), -1 if none.
+    int next_occupied(int level, int from) const;
 };
 
-#endif // SERVER_EVENTS_H
\ No newline at end of file
+#endif // SERVER_EVENTS_H
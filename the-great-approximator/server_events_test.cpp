@@ -0,0 +1,133 @@
+// The timing wheel of EventManager against the order of the deadlines: timers scheduled,
+// cancelled and rescheduled at random, some from callbacks, with deadlines on all levels of
+// the wheel. The clock runs 1000 times faster than real time, so that the test takes well
+// under a second.
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "game_clock.h"
+#include "server_events.h"
+#include "test.h"
+
+namespace {
+
+constexpr int time_scale = 1000;
+constexpr int timer_count = 3000;
+constexpr int max_offset_ms = 300000; // beyond the second level of the wheel
+constexpr int max_reschedule_ms = 5000;
+
+struct TestTimer : TimerNode {
+    int offset_ms; // deadline, from the base time of the test
+    bool fired = false;
+};
+
+struct WheelTest {
+    EventManager* event_manager;
+    GameClock::time_point base;
+    std::vector<std::unique_ptr<TestTimer>> timers;
+    std::vector<int> fired_offsets;
+    std::mt19937_64 rng;
+    int rescheduled = 0;
+};
+
+WheelTest* current_test = nullptr;
+
+GameClock::time_point deadline(const WheelTest& test, int offset_ms) {
+    return test.base + std::chrono::milliseconds(offset_ms);
+}
+
+void on_timer(TimerNode& node) {
+    WheelTest& test = *current_test;
+    TestTimer& timer = static_cast<TestTimer&>(node);
+    CHECK(!timer.fired);
+    CHECK(test.event_manager->now() >= deadline(test, timer.offset_ms)); // never early
+    timer.fired = true;
+    // Deadlines in the past fire in the first tick, in any order.
+    test.fired_offsets.push_back(std::max(timer.offset_ms, 0));
+
+    // Callbacks may cancel other timers and schedule new ones, also due right away.
+    TestTimer& other = *test.timers[test.rng() % test.timers.size()];
+    if (test.rng() % 8 == 0 && other.is_scheduled()) {
+        test.event_manager->cancel(other);
+        other.fired = true; // must not fire any more
+    }
+    if (test.rescheduled < timer_count / 4 && test.rng() % 4 == 0) {
+        test.rescheduled++;
+        timer.fired = false;
+        timer.offset_ms += test.rng() % 3 == 0 ? 0 : test.rng() % max_reschedule_ms;
+        test.event_manager->schedule(timer, deadline(test, timer.offset_ms));
+    }
+}
+
+void test_random_timers() {
+    GameClock clock(time_scale);
+    EventManager event_manager(clock);
+    CHECK(event_manager.next_timeout_ms() == -1);
+
+    WheelTest test;
+    test.event_manager = &event_manager;
+    test.base = event_manager.now();
+    test.rng.seed(2024);
+    current_test = &test;
+
+    for (int i = 0; i < timer_count; i++) {
+        auto timer = std::make_unique<TestTimer>();
+        // Mostly near deadlines, some on the upper levels, some in the past.
+        int range = i % 10 == 0 ? max_offset_ms : i % 3 == 0 ? 70000 : 300;
+        timer->offset_ms = (int)(test.rng() % range) - (i % 50 == 0 ? 100 : 0);
+        timer->set_callback(on_timer);
+        event_manager.schedule(*timer, deadline(test, timer->offset_ms));
+        CHECK(timer->is_scheduled());
+        test.timers.push_back(std::move(timer));
+    }
+    for (int i = 0; i < timer_count; i += 7) {
+        event_manager.cancel(*test.timers[i]);
+        event_manager.cancel(*test.timers[i]); // no-op
+        test.timers[i]->fired = true;
+        CHECK(!test.timers[i]->is_scheduled());
+    }
+
+    while (true) {
+        GameClock::time_point now = event_manager.now();
+        int timeout_ms = event_manager.next_timeout_ms();
+        if (timeout_ms < 0) {
+            break;
+        }
+        // Every timer is due by now, a wheel that lost some would make the loop run forever.
+        if (now > deadline(test, max_offset_ms + timer_count / 4 * max_reschedule_ms)) {
+            CHECK(!"timers are still scheduled after their deadlines");
+            break;
+        }
+        // The loop never sleeps past the earliest deadline.
+        int earliest = max_offset_ms * 2;
+        for (const auto& timer : test.timers) {
+            if (timer->is_scheduled()) {
+                earliest = std::min(earliest, timer->offset_ms);
+            }
+        }
+        auto until_earliest = deadline(test, earliest) - now;
+        uint64_t real_ms = clock.to_real_ms(std::max<int64_t>(
+            std::chrono::ceil<std::chrono::milliseconds>(until_earliest).count(), 0));
+        CHECK((uint64_t)timeout_ms <= real_ms + 1);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        event_manager.check_timers();
+    }
+
+    CHECK(std::is_sorted(test.fired_offsets.begin(), test.fired_offsets.end()));
+    for (const auto& timer : test.timers) {
+        CHECK(timer->fired && !timer->is_scheduled());
+    }
+    current_test = nullptr;
+}
+
+} // namespace
+
+void test_server_events() {
+    test_random_timers();
+}
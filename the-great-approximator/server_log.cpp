@@ -0,0 +1,457 @@
+#include "server_log.h"
+
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "constants.h"
+#include "msg_parser.h"
+#include "networking.h"
+
+namespace {
+
+// Formatted output is written once there is this much of it, or when there is nothing more
+// to format.
+constexpr size_t output_flush_size = 64 * 1024;
+
+// The formatter polls the rings, sleeping longer and longer while they stay empty.
+constexpr auto min_idle_sleep = std::chrono::milliseconds(1);
+constexpr auto max_idle_sleep = std::chrono::milliseconds(16);
+
+// Longest text stored in a record, so that every record fits in the ring. Longer lines of
+// ShardLog::text() are stored as payloads.
+constexpr size_t max_record_text = constants::log_ring_size / 4;
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void append_double(std::string& out, double value) {
+    size_t start = out.size();
+    out.resize(start + MessageParser::formattedDoubleLength(std::fabs(value)));
+    char* end = MessageParser::formatDouble(value, out.data() + start, out.data() + out.size());
+    out.resize(end - out.data());
+}
+
+// Values of STATE, without the command and CRLF.
+std::string_view state_values(const std::string& state_msg) {
+    const size_t prefix_length = std::string_view("STATE ").length();
+    return std::string_view(state_msg)
+        .substr(prefix_length, state_msg.size() - prefix_length - constants::crlf.size());
+}
+
+} // namespace
+
+ShardLog::ShardLog(LogLevel level, int sample_interval)
+    : level(level),
+      sample_interval(sample_interval),
+      sample_countdown(1),
+      lossless(level == LogLevel::STATES && sample_interval == 1),
+      ring(std::make_unique<uint64_t[]>(constants::log_ring_size / sizeof(uint64_t))),
+      capacity(constants::log_ring_size),
+      write_pos(0),
+      cached_read_pos(0),
+      lost(0),
+      payload_bytes_added(0),
+      published_pos(0),
+      read_pos(0),
+      payload_bytes_released(0) {
+    static_assert((constants::log_ring_size & (constants::log_ring_size - 1)) == 0,
+                  "log ring size must be a power of two");
+}
+
+ShardLog::~ShardLog() {
+    consume([](const Record&, const std::string*, std::string_view) {}); // frees payloads
+}
+
+void ShardLog::new_client(int slot, const struct sockaddr_storage& address) {
+    if (enabled(LogLevel::CONNECTIONS)) {
+        size_t length = address.ss_family == AF_INET ? sizeof(struct sockaddr_in)
+                                                     : sizeof(struct sockaddr_in6);
+        add(RecordType::NEW_CLIENT, slot, 0, 0.0, 0.0,
+            std::string_view((const char*)&address, length));
+    }
+}
+
+void ShardLog::player_known(int slot, std::string_view id) {
+    if (enabled(LogLevel::CONNECTIONS)) {
+        add(RecordType::PLAYER_KNOWN, slot, 0, 0.0, 0.0, id);
+    }
+}
+
+void ShardLog::coefficients(int slot, std::string_view coeff_line) {
+    if (enabled(LogLevel::CONNECTIONS)) {
+        add(RecordType::COEFFICIENTS, slot, 0, 0.0, 0.0, coeff_line);
+    }
+}
+
+void ShardLog::hello_timeout(int slot) {
+    if (enabled(LogLevel::CONNECTIONS)) {
+        add(RecordType::HELLO_TIMEOUT, slot, 0, 0.0, 0.0, {});
+    }
+}
+
+void ShardLog::message_before_hello() {
+    if (enabled(LogLevel::CONNECTIONS)) {
+        add(RecordType::MESSAGE_BEFORE_HELLO, -1, 0, 0.0, 0.0, {});
+    }
+}
+
+void ShardLog::no_room(int slot, std::string_view id) {
+    if (enabled(LogLevel::CONNECTIONS)) {
+        add(RecordType::NO_ROOM, slot, 0, 0.0, 0.0, id);
+    }
+}
+
+void ShardLog::disconnect(int slot) {
+    if (enabled(LogLevel::CONNECTIONS)) {
+        add(RecordType::DISCONNECT, slot, 0, 0.0, 0.0, {});
+    }
+}
+
+void ShardLog::early_put(int slot, int point, double value) {
+    if (enabled(LogLevel::PUTS) && sample()) {
+        add(RecordType::EARLY_PUT, slot, point, value, 0.0, {});
+    }
+}
+
+void ShardLog::bad_put(int slot, int point, double value) {
+    if (enabled(LogLevel::PUTS) && sample()) {
+        add(RecordType::BAD_PUT, slot, point, value, 0.0, {});
+    }
+}
+
+void ShardLog::put_with_state(int slot, int point, double put_value, const Payload& state_msg) {
+    if (enabled(LogLevel::PUTS) && sample()) {
+        add(RecordType::PUT_WITH_STATE, slot, point, put_value, 0.0, {},
+            enabled(LogLevel::STATES) ? &state_msg : nullptr);
+    }
+}
+
+void ShardLog::put_with_delta(int slot, int point, double put_value, double value) {
+    if (enabled(LogLevel::PUTS) && sample()) {
+        add(RecordType::PUT_WITH_DELTA, slot, point, put_value, value, {});
+    }
+}
+
+void ShardLog::sending_state(int slot, const Payload& state_msg) {
+    if (enabled(LogLevel::PUTS) && sample()) {
+        add(RecordType::SENDING_STATE, slot, 0, 0.0, 0.0, {},
+            enabled(LogLevel::STATES) ? &state_msg : nullptr);
+    }
+}
+
+void ShardLog::sending_state_delta(int slot, int point, double value) {
+    if (enabled(LogLevel::PUTS) && sample()) {
+        add(RecordType::SENDING_STATE_DELTA, slot, point, value, 0.0, {});
+    }
+}
+
+void ShardLog::text(std::string_view line) {
+    // A long line (the scores of a big room) is kept out of the ring, like a STATE.
+    if (line.size() > max_record_text) {
+        Payload payload = std::make_shared<const std::string>(line);
+        add(RecordType::TEXT, -1, 0, 0.0, 0.0, {}, &payload);
+        return;
+    }
+    add(RecordType::TEXT, -1, 0, 0.0, 0.0, line);
+}
+
+bool ShardLog::sample() {
+    if (--sample_countdown > 0) {
+        return false;
+    }
+    sample_countdown = sample_interval;
+    return true;
+}
+
+void ShardLog::add(RecordType type, int slot, int number, double value0, double value1,
+                   std::string_view text, const Payload* payload) {
+    text = text.substr(0, max_record_text); // so that every record fits in the ring
+    size_t payload_space = payload ? sizeof(Payload) : 0;
+    size_t size = (sizeof(Record) + payload_space + text.size() + 7) & ~(size_t)7;
+    size_t payload_size = payload ? (*payload)->size() : 0;
+
+    // A record does not wrap around; if it does not fit before the end of the ring, the rest
+    // of the ring is skipped.
+    size_t index = write_pos & (capacity - 1);
+    size_t to_end = capacity - index;
+    size_t needed = to_end < size ? to_end + size : size;
+    while (!has_space(needed, payload_size)) {
+        if (!lossless) {
+            lost++;
+            return;
+        }
+        std::this_thread::yield(); // the formatter is busy, the ring is not empty
+    }
+
+    char* base = reinterpret_cast<char*>(ring.get());
+    if (to_end < size) {
+        if (to_end >= sizeof(Record)) { // otherwise the reader skips the rest by itself
+            Record wrap{};
+            wrap.type = RecordType::WRAP;
+            memcpy(base + index, &wrap, sizeof(wrap));
+        }
+        write_pos += to_end;
+        index = 0;
+    }
+
+    Record record{};
+    record.time_ns = now_ns();
+    record.size = size;
+    record.type = type;
+    record.has_payload = payload != nullptr;
+    record.slot = slot;
+    record.number = number;
+    record.text_length = text.size();
+    record.lost_before = lost;
+    record.values[0] = value0;
+    record.values[1] = value1;
+    memcpy(base + index, &record, sizeof(record));
+    if (payload) {
+        new (base + index + sizeof(record)) Payload(*payload);
+        payload_bytes_added += payload_size;
+    }
+    memcpy(base + index + sizeof(record) + payload_space, text.data(), text.size());
+
+    write_pos += size;
+    lost = 0;
+    published_pos.store(write_pos, std::memory_order_release);
+}
+
+bool ShardLog::has_space(size_t needed, size_t payload_size) {
+    if (write_pos + needed - cached_read_pos > capacity) {
+        cached_read_pos = read_pos.load(std::memory_order_acquire);
+        if (write_pos + needed - cached_read_pos > capacity) {
+            return false;
+        }
+    }
+    // Messages referenced by the ring are not freed, their total size is limited too. A
+    // single message over the limit is let through once the others are released.
+    size_t payload_in_ring =
+        payload_bytes_added - payload_bytes_released.load(std::memory_order_relaxed);
+    return payload_size == 0 || payload_in_ring == 0 ||
+           payload_in_ring + payload_size <= constants::log_payload_limit;
+}
+
+template <typename Handler>
+bool ShardLog::consume(Handler&& handler) {
+    uint64_t position = read_pos.load(std::memory_order_relaxed);
+    uint64_t end = published_pos.load(std::memory_order_acquire);
+    if (position == end) {
+        return false;
+    }
+
+    char* base = reinterpret_cast<char*>(ring.get());
+    while (position != end) {
+        size_t index = position & (capacity - 1);
+        size_t to_end = capacity - index;
+
+        Record record;
+        if (to_end < sizeof(record)) {
+            position += to_end;
+            continue;
+        }
+        memcpy(&record, base + index, sizeof(record));
+        if (record.type == RecordType::WRAP) {
+            position += to_end;
+            continue;
+        }
+
+        Payload* payload = nullptr;
+        size_t payload_space = 0;
+        if (record.has_payload) {
+            payload = std::launder(reinterpret_cast<Payload*>(base + index + sizeof(record)));
+            payload_space = sizeof(Payload);
+        }
+        std::string_view text(base + index + sizeof(record) + payload_space, record.text_length);
+        handler(record, payload ? payload->get() : nullptr, text);
+
+        if (payload) {
+            size_t payload_size = (*payload)->size();
+            payload->~Payload();
+            payload_bytes_released.fetch_add(payload_size, std::memory_order_relaxed);
+        }
+        position += record.size;
+        read_pos.store(position, std::memory_order_release);
+    }
+    return true;
+}
+
+ServerLog::ServerLog(LogLevel level, int sample_interval, bool timestamps, int shard_count)
+    : timestamps(timestamps),
+      start_time_ns(now_ns()),
+      shard_logs(),
+      players(shard_count),
+      output(),
+      stopping(false),
+      drained(),
+      formatter_thread() {
+    for (int i = 0; i < shard_count; i++) {
+        shard_logs.push_back(std::make_unique<ShardLog>(level, sample_interval));
+    }
+    formatter_thread = std::thread(&ServerLog::format_loop, this);
+}
+
+void ServerLog::drain() {
+    std::call_once(drained, [this] {
+        stopping.store(true, std::memory_order_release);
+        formatter_thread.join();
+    });
+}
+
+void ServerLog::format_loop() {
+    auto idle_sleep = min_idle_sleep;
+    while (true) {
+        // Read before the rings, so that records written before stopping are formatted.
+        bool stop = stopping.load(std::memory_order_acquire);
+
+        bool formatted = false;
+        for (size_t i = 0; i < shard_logs.size(); i++) {
+            std::vector<Player>& shard_players = players[i];
+            formatted |= shard_logs[i]->consume(
+                [&](const ShardLog::Record& record, const std::string* payload,
+                    std::string_view text) {
+                    format_record(record, payload, text, shard_players);
+                    if (output.size() >= output_flush_size) {
+                        write_output();
+                    }
+                });
+        }
+
+        if (formatted) {
+            idle_sleep = min_idle_sleep;
+            continue;
+        }
+
+        write_output();
+        if (stop) {
+            return;
+        }
+        std::this_thread::sleep_for(idle_sleep);
+        idle_sleep = std::min(idle_sleep * 2, max_idle_sleep);
+    }
+}
+
+void ServerLog::format_record(const ShardLog::Record& record, const std::string* payload,
+                              std::string_view text, std::vector<Player>& shard_players) {
+    using RecordType = ShardLog::RecordType;
+
+    if (record.lost_before > 0) {
+        output += "(" + std::to_string(record.lost_before) + " log records lost)\n";
+    }
+
+    Player* player = nullptr;
+    if (record.slot >= 0) {
+        if ((size_t)record.slot >= shard_players.size()) {
+            shard_players.resize(record.slot + 1);
+        }
+        player = &shard_players[record.slot];
+    }
+    int point = record.number;
+    double value = record.values[0];
+
+    if (timestamps) {
+        char buffer[32];
+        int length = snprintf(buffer, sizeof(buffer), "[%.6f] ",
+                              (record.time_ns - start_time_ns) / 1e9);
+        output.append(buffer, length);
+    }
+
+    switch (record.type) {
+        case RecordType::WRAP: break;
+        case RecordType::NEW_CLIENT: {
+            struct sockaddr_storage address = {};
+            memcpy(&address, text.data(), std::min(text.size(), sizeof(address)));
+            player->ip = get_address_ip(address);
+            player->port = get_address_port(address);
+            player->id = "UNKNOWN";
+            output += "New client [" + player->ip + "]:" + std::to_string(player->port);
+            break;
+        }
+        case RecordType::PLAYER_KNOWN:
+            player->id = text;
+            output += "[" + player->ip + "]:" + std::to_string(player->port) +
+                      " is now known as " + player->id + ".";
+            break;
+        case RecordType::COEFFICIENTS:
+            output += player->id;
+            output += "'s coefficients are ";
+            output += text;
+            break;
+        case RecordType::HELLO_TIMEOUT:
+            output += "Did not receive hello from [" + player->ip + "]:" +
+                      std::to_string(player->port) + ".";
+            break;
+        case RecordType::MESSAGE_BEFORE_HELLO: output += "Client sent message before hello."; break;
+        case RecordType::NO_ROOM:
+            output += "No room for " + std::string(text) + " from [" + player->ip + "]:" +
+                      std::to_string(player->port) + ".";
+            break;
+        case RecordType::DISCONNECT: output += "Disconnecting " + player->id; break;
+        case RecordType::EARLY_PUT:
+        case RecordType::BAD_PUT:
+            output += player->id + " tried to put ";
+            append_double(output, value);
+            output += " in " + std::to_string(point);
+            output += record.type == RecordType::EARLY_PUT ? " before it could put."
+                                                           : " which is out of range.";
+            break;
+        case RecordType::PUT_WITH_STATE:
+            output += player->id + " puts ";
+            append_double(output, value);
+            output += " in " + std::to_string(point);
+            if (payload) {
+                output += ", current state ";
+                output += state_values(*payload);
+            }
+            break;
+        case RecordType::PUT_WITH_DELTA:
+            output += player->id + " puts ";
+            append_double(output, value);
+            output += " in " + std::to_string(point) + ", current value ";
+            append_double(output, record.values[1]);
+            break;
+        case RecordType::SENDING_STATE:
+            output += "Sending state ";
+            if (payload) {
+                output += state_values(*payload);
+                output += " ";
+            }
+            output += "to " + player->id + ".";
+            break;
+        case RecordType::SENDING_STATE_DELTA:
+            output += "Sending state delta " + std::to_string(point) + " ";
+            append_double(output, value);
+            output += " to " + player->id + ".";
+            break;
+        case RecordType::TEXT:
+            if (payload) {
+                output += *payload;
+            } else {
+                output += text;
+            }
+            break;
+    }
+    output += "\n";
+}
+
+void ServerLog::write_output() {
+    if (output.empty()) {
+        return;
+    }
+    fwrite(output.data(), 1, output.size(), stdout);
+    fflush(stdout);
+    output.clear();
+}
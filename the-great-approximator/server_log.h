@@ -0,0 +1,172 @@
+#ifndef SERVER_LOG_H
+#define SERVER_LOG_H
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Verbosity of the server log; every level includes the ones before it.
+enum class LogLevel {
+    GAMES,       // game ends only
+    CONNECTIONS, // clients connecting, saying hello and disconnecting
+    PUTS,        // puts and responses to them, without the STATE payloads
+    STATES,      // everything, including every STATE sent (the default)
+};
+
+// Log of one shard, written only by its thread.
+// Every call stores a compact binary record (type, timestamp, player slot and numbers) in
+// a ring buffer, without locks, system calls or formatting; the ServerLog thread turns the
+// records into text. A STATE is not copied, the record keeps a reference to the message
+// sent to the player.
+// When the ring is full, or the STATEs it references take too much memory, a fully enabled
+// log (LogLevel::STATES, no sampling) waits for the formatter, so that no line is lost.
+// At a reduced level or with sampling the record is dropped instead and counted.
+// Players are identified by their slot (the descriptor of the connection); the formatter
+// learns their addresses and ids from the records themselves. Addresses are recorded in
+// binary form and turned into text by the formatter too.
+class ShardLog {
+ public:
+    using Payload = std::shared_ptr<const std::string>;
+
+    ShardLog(LogLevel level, int sample_interval);
+    ~ShardLog();
+    ShardLog(const ShardLog&) = delete;
+    ShardLog& operator=(const ShardLog&) = delete;
+
+    void new_client(int slot, const struct sockaddr_storage& address);
+    void player_known(int slot, std::string_view id);
+    void coefficients(int slot, std::string_view coeff_line); // without CRLF
+    void hello_timeout(int slot);
+    void message_before_hello();
+    void no_room(int slot, std::string_view id); // HELLO of id rejected, its rooms are full
+    void disconnect(int slot);
+
+    // Only one in sample_interval of the put-level calls below is recorded.
+    void early_put(int slot, int point, double value);
+    void bad_put(int slot, int point, double value);
+    // Accepted put answered with state_msg, a STATE message with CRLF.
+    void put_with_state(int slot, int point, double put_value, const Payload& state_msg);
+    // Accepted put answered with STATE_DELTA; value is the new approximation at point.
+    void put_with_delta(int slot, int point, double put_value, double value);
+    void sending_state(int slot, const Payload& state_msg);
+    void sending_state_delta(int slot, int point, double value);
+
+    // Line printed as is, at every level.
+    void text(std::string_view line);
+
+ private:
+    friend class ServerLog;
+
+    enum class RecordType : uint16_t {
+        WRAP, // rest of the ring is unused, the next record starts at its beginning
+        NEW_CLIENT,
+        PLAYER_KNOWN,
+        COEFFICIENTS,
+        HELLO_TIMEOUT,
+        MESSAGE_BEFORE_HELLO,
+        NO_ROOM,
+        DISCONNECT,
+        EARLY_PUT,
+        BAD_PUT,
+        PUT_WITH_STATE,
+        PUT_WITH_DELTA,
+        SENDING_STATE,
+        SENDING_STATE_DELTA,
+        TEXT,
+    };
+
+    // Followed by a Payload if has_payload is set, then by text_length bytes of text, padded
+    // to a multiple of 8 bytes.
+    struct Record {
+        int64_t time_ns; // steady clock
+        uint32_t size;   // of the whole record
+        RecordType type;
+        bool has_payload;
+        int32_t slot;
+        int32_t number; // point or port
+        uint32_t text_length;
+        uint32_t lost_before; // records dropped since the previous one
+        double values[2];
+    };
+
+    LogLevel level;
+    int sample_interval;
+    int sample_countdown;
+    bool lossless; // waits for space instead of dropping records
+
+    std::unique_ptr<uint64_t[]> ring; // uint64_t keeps records aligned
+    size_t capacity;                  // bytes, a power of two
+    uint64_t write_pos;               // producer only
+    uint64_t cached_read_pos;         // producer's copy of read_pos
+    uint32_t lost;                    // producer only
+    size_t payload_bytes_added;       // producer only
+    alignas(64) std::atomic<uint64_t> published_pos; // records before it are complete
+    alignas(64) std::atomic<uint64_t> read_pos;      // written by the formatter
+    std::atomic<size_t> payload_bytes_released;      // written by the formatter
+
+    bool enabled(LogLevel required) const { return level >= required; }
+    bool sample();
+    // Whether a record of size bytes in the ring, and a payload of payload_size bytes, fit.
+    bool has_space(size_t needed, size_t payload_size);
+    void add(RecordType type, int slot, int number, double value0, double value1,
+             std::string_view text, const Payload* payload = nullptr);
+
+    // Called by the formatter: passes every published record to
+    // handler(record, payload or nullptr, text) and frees it.
+    // Returns whether there were any.
+    template <typename Handler>
+    bool consume(Handler&& handler);
+};
+
+// Asynchronous text log of the server: a background thread formats the records of all
+// shards and writes them to standard output.
+// At LogLevel::STATES the output is the same as printing every line directly. Lines of
+// one shard keep their order; lines of different shards may be interleaved differently
+// than they happened.
+class ServerLog {
+ public:
+    ServerLog(LogLevel level, int sample_interval, bool timestamps, int shard_count);
+    // Writes out all records logged so far.
+    ~ServerLog() { drain(); }
+    ServerLog(const ServerLog&) = delete;
+    ServerLog& operator=(const ServerLog&) = delete;
+
+    ShardLog& getShardLog(int shard_index) { return *shard_logs[shard_index]; }
+
+    // Writes out all records logged so far and stops the formatter; records logged later are
+    // not written. The shards run forever, so the server calls it when it exits on an error
+    // or a signal. Only the first call does anything, later calls wait for it to finish.
+    void drain();
+
+ private:
+    // What the formatter knows about the player in a slot of a shard.
+    struct Player {
+        std::string ip;
+        int port = 0;
+        std::string id;
+    };
+
+    bool timestamps;
+    int64_t start_time_ns;
+    std::vector<std::unique_ptr<ShardLog>> shard_logs;
+    std::vector<std::vector<Player>> players; // [shard][slot], used by the formatter only
+    std::string output;                       // formatted, not written yet
+    std::atomic<bool> stopping;
+    std::once_flag drained;
+    std::thread formatter_thread; // started last
+
+    void format_loop();
+    void format_record(const ShardLog::Record& record, const std::string* payload,
+                       std::string_view text, std::vector<Player>& shard_players);
+    void write_output();
+};
+
+#endif // SERVER_LOG_H
@@ -1,156 +1,243 @@
 #include "server_logic.h"
 
-#include <cassert>
-#include <iostream>
+#include <algorithm>
+#include <cctype>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
 
 #include "constants.h"
 #include "error.h"
+#include "networking.h"
+#include "poly_kernel.h"
 #include "server_events.h"
 
-ServerLogic::ServerLogic(int K, int N, int M, const std::string& file_name,
-                         EventManager& event_manager)
-    : K(K),
-      N(N),
-      M(M),
-      file_name(file_name),
-      total_correct_puts(0),
-      coeff_file(file_name, std::ios_base::in),
+ServerLogic::ServerLogic(GameCoordinator& coordinator, EventManager& event_manager,
+                         OutputMemoryGauge& output_gauge, ShardLog& log, ShardTrace* trace)
+    : coordinator(coordinator),
+      rooms(coordinator.getRoomCount()),
       players(),
+      next_connection_id(0),
       event_manager(event_manager),
-      stopping(false) {
-    if (coeff_file.rdstate() == std::ios_base::failbit || !coeff_file.is_open()) {
-        syserr("could not open coefficients file: %s", file_name.c_str());
+      output_gauge(output_gauge),
+      log(log),
+      trace(trace),
+      clients_with_new_messages(),
+      timed_out_clients(),
+      event_pool(),
+      free_events() {
+    for (size_t i = 0; i < rooms.size(); i++) {
+        rooms[i].K = coordinator.getRoomConfig(i).K;
     }
 }
 
-void ServerLogic::register_new_client(int client_fd, const std::string& ip, int port) {
-    std::cout << "New client [" << ip << "]:" << port << std::endl;
-    PlayerInfo new_player;
+uint64_t ServerLogic::register_new_client(int client_fd,
+                                          const struct sockaddr_storage& address) {
+    log.new_client(client_fd, address);
+    PlayerInfo& new_player = players.insert(client_fd);
+    new_player.connection_id = next_connection_id++;
     new_player.id = "UNKNOWN";
-    new_player.ip = ip;
-    new_player.port = port;
-    new_player.messages = std::deque<std::string>();
-    new_player.approximations = std::vector<double>(K + 1, 0.0);
-    new_player.coefficients = std::vector<double>(N + 1);
+    new_player.address = address;
+    new_player.room = -1;
+    new_player.room_position = 0;
+    new_player.waiting = false;
+    new_player.messages.clear();
+    new_player.messages.set_gauge(&output_gauge);
+    new_player.approximations.clear();
+    new_player.real_values.clear();
+    new_player.squared_error = 0.0;
     new_player.penalty = 0.0;
     new_player.is_known = false;
     new_player.correct_puts = 0;
     new_player.can_put = false;
+    new_player.window = 0;
+    new_player.credits = 0;
+    new_player.first_response = nullptr;
+    new_player.last_response = nullptr;
     new_player.delay = 0;
+    new_player.state_delta = false;
+    new_player.state_deltas_left = 0;
+    new_player.hello_timeout = &schedule_player_event(
+        client_fd, PlayerEventType::HELLO_TIMEOUT,
+        event_manager.now() + std::chrono::seconds(constants::hello_wait_time));
 
-    players[client_fd] = std::move(new_player);
+    return new_player.connection_id;
 }
 
 bool ServerLogic::is_client_connected(int client_fd) const {
-    return players.find(client_fd) != players.end();
+    return players.contains(client_fd);
 }
 
-bool ServerLogic::validate_client(int client_fd, const std::string& ip, int port) const {
-    if (!is_client_connected(client_fd)) {
-        return false;
-    }
+bool ServerLogic::validate_client(int client_fd, uint64_t connection_id) const {
+    return is_client_connected(client_fd) && players[client_fd].connection_id == connection_id;
+}
 
-    const PlayerInfo& player = players.at(client_fd);
-    return player.ip == ip && player.port == port;
+OutputQueue& ServerLogic::getMessages(int client_fd) {
+    return players[client_fd].messages;
 }
 
-bool ServerLogic::has_pending_messages(int client_fd) const {
-    assert(is_client_connected(client_fd));
-    return !players.at(client_fd).messages.empty();
+void ServerLogic::append_message_back(int client_fd, std::string msg) {
+    OutputQueue& messages = players[client_fd].messages;
+    if (trace) {
+        trace->message_out(client_fd, msg);
+    }
+    if (messages.empty()) {
+        clients_with_new_messages.push_back(client_fd);
+    }
+    messages.push(std::move(msg));
 }
 
-std::string ServerLogic::take_next_message_str(int client_fd) {
-    assert(is_client_connected(client_fd));
-    std::string msg_str = players.at(client_fd).messages.front();
-    players[client_fd].messages.pop_front();
-    return msg_str;
+void ServerLogic::append_message_back(int client_fd, std::shared_ptr<const std::string> msg) {
+    OutputQueue& messages = players[client_fd].messages;
+    if (trace) {
+        trace->message_out(client_fd, *msg);
+    }
+    if (messages.empty()) {
+        clients_with_new_messages.push_back(client_fd);
+    }
+    messages.push(std::move(msg));
 }
 
-void ServerLogic::append_message_front(int client_fd, const std::string& msg) {
-    assert(is_client_connected(client_fd));
-    players[client_fd].messages.push_front(msg);
+void ServerLogic::take_clients_with_new_messages(std::vector<int>& out_fds) {
+    out_fds.clear();
+    out_fds.swap(clients_with_new_messages);
 }
 
-void ServerLogic::append_message_back(int client_fd, const std::string& msg) {
-    assert(is_client_connected(client_fd));
-    players[client_fd].messages.push_back(msg);
+void ServerLogic::take_timed_out_clients(std::vector<int>& out_fds) {
+    out_fds.clear();
+    out_fds.swap(timed_out_clients);
 }
 
-std::string ServerLogic::getClientPlayerID(int client_fd) const {
-    assert(is_client_connected(client_fd));
-    return players.at(client_fd).id;
+const std::string& ServerLogic::getClientPlayerID(int client_fd) const {
+    return players[client_fd].id;
 }
 std::string ServerLogic::getClientIP(int client_fd) const {
-    assert(is_client_connected(client_fd));
-    return players.at(client_fd).ip;
+    return get_address_ip(players[client_fd].address);
 }
 int ServerLogic::getClientPort(int client_fd) const {
-    assert(is_client_connected(client_fd));
-    return players.at(client_fd).port;
+    return get_address_port(players[client_fd].address);
 }
 const PlayerInfo& ServerLogic::getPlayerInfo(int client_fd) const {
-    assert(is_client_connected(client_fd));
-    return players.at(client_fd);
+    return players[client_fd];
+}
+const std::vector<int>& ServerLogic::getRoomPlayerFds(int room) const {
+    return rooms[room].player_fds;
 }
-bool ServerLogic::is_stopping() const {
-    return stopping;
+bool ServerLogic::is_game_over(int client_fd) const {
+    int room = players[client_fd].room;
+    return room >= 0 && coordinator.is_game_over(room);
 }
 
 void ServerLogic::handle_client_disconnect(int client_fd) {
-    assert(is_client_connected(client_fd));
-    total_correct_puts -= players[client_fd].correct_puts;
+    PlayerInfo& player = players[client_fd];
+    if (player.hello_timeout) {
+        event_manager.cancel(*player.hello_timeout);
+        free_events.push_back(player.hello_timeout);
+    }
+    release_responses(player);
+    if (player.room >= 0) {
+        coordinator.remove_correct_puts(player.room, player.correct_puts);
+        leave_room(client_fd);
+    }
     players.erase(client_fd);
 }
 
-bool ServerLogic::handle_client_message(int client_fd, std::unique_ptr<Message> msg) {
-    assert(is_client_connected(client_fd));
-    switch (msg->getType()) {
-        case MessageType::HELLO:
-            return handle_hello(client_fd, dynamic_cast<HelloMessage*>(msg.get()));
-        case MessageType::PUT:
-            return handle_put(client_fd, dynamic_cast<PutMessage*>(msg.get()));
+// Removes the player from the list of its room in O(1), moving the last one into its place.
+void ServerLogic::leave_room(int client_fd) {
+    PlayerInfo& player = players[client_fd];
+    Room& room = rooms[player.room];
+    std::vector<int>& fds = player.waiting ? room.waiting_fds : room.player_fds;
+    int last_fd = fds.back();
+    fds[player.room_position] = last_fd;
+    players[last_fd].room_position = player.room_position;
+    fds.pop_back();
+    coordinator.leave_room(player.room);
+    player.room = -1;
+}
+
+bool ServerLogic::handle_client_message(int client_fd, const Message& msg) {
+    switch (getMessageType(msg)) {
+        case MessageType::HELLO: return handle_hello(client_fd, std::get<HelloMessage>(msg));
+        case MessageType::PUT: return handle_put(client_fd, std::get<PutMessage>(msg));
         default: return false;
     }
 }
 
-bool ServerLogic::handle_hello(int client_fd, HelloMessage* msg) {
+bool ServerLogic::handle_hello(int client_fd, const HelloMessage& msg) {
     PlayerInfo& player = players[client_fd];
 
     if (player.is_known) {
         return false;
     }
 
-    player.id = msg->getPlayerId();
+    int room = coordinator.join_room(msg.room);
+    if (room < 0) {
+        log.no_room(client_fd, msg.player_id);
+        return false; // the player stays unknown and is disconnected
+    }
+
+    player.id = msg.player_id;
+    player.state_delta = msg.state_delta;
+    player.window = std::min(msg.window, constants::max_put_window);
     player.delay = std::count_if(player.id.begin(), player.id.end(),
                                  [](char c) { return std::islower(c); });
 
-    std::cout << "[" << player.ip << "]:" << player.port << " is now known as " << player.id
-              << "." << std::endl;
+    log.player_known(client_fd, player.id);
 
     player.is_known = true;
-    player.can_put = true;
+    event_manager.cancel(*player.hello_timeout);
+    free_events.push_back(player.hello_timeout);
+    player.hello_timeout = nullptr;
+
+    player.room = room;
+    Room& player_room = rooms[room];
+    if (!player_room.playing) {
+        player.waiting = true;
+        player.room_position = player_room.waiting_fds.size();
+        player_room.waiting_fds.push_back(client_fd);
+        return true;
+    }
 
-    std::string coeffs_str;
-    std::getline(coeff_file, coeffs_str, '\n');
-    coeffs_str += '\n';
+    player.room_position = player_room.player_fds.size();
+    player_room.player_fds.push_back(client_fd);
+    start_playing(client_fd);
+    return true;
+}
+
+void ServerLogic::start_playing(int client_fd) {
+    PlayerInfo& player = players[client_fd];
+    int K = rooms[player.room].K;
+    player.can_put = true;
+    player.approximations.assign(K + 1, 0.0);
 
-    std::unique_ptr<Message> coeff_msg = Message::createMessage(coeffs_str);
-    if (!coeff_msg) {
+    CoeffPrefetcher::Coefficients coefficients;
+    if (!coordinator.next_coefficients(coefficients)) {
         fatal("could not create coeff message");
     }
 
-    player.coefficients = dynamic_cast<CoeffMessage*>(coeff_msg.get())->getCoeffs();
+    fill_poly_values(coefficients.coeffs, K, player.real_values);
 
-    std::cout << player.id << "'s coefficients are "
-              << coeffs_str.substr(0, coeffs_str.find(constants::crlf)) << std::endl;
+    // All approximations are zero before the first put.
+    player.squared_error = 0.0;
+    for (double real_value : player.real_values) {
+        player.squared_error += (long double)real_value * real_value;
+    }
 
-    append_message_back(client_fd, coeff_msg->getRawMessage());
-    return true;
+    log.coefficients(client_fd, std::string_view(coefficients.message)
+                                    .substr(0, coefficients.message.size() -
+                                                   constants::crlf.size()));
+
+    append_message_back(client_fd, std::move(coefficients.message));
+
+    if (player.window > 0) {
+        player.credits = player.window;
+        append_message_back(client_fd, MessageParser::formatMessage(WindowMessage{player.window}));
+    }
 }
 
-bool ServerLogic::handle_put(int client_fd, PutMessage* msg) {
+bool ServerLogic::handle_put(int client_fd, const PutMessage& msg) {
     PlayerInfo& player = players[client_fd];
 
     if (!player.is_known) {
@@ -159,22 +246,30 @@ bool ServerLogic::handle_put(int client_fd, PutMessage* msg) {
 
     bool successful_put = true;
 
-    if (!player.can_put) {
-        successful_put = false;
-        std::cout << player.id << " tried to put " << msg->getValue() << " in "
-                  << msg->getPoint() << " before it could put." << std::endl;
-        respond_with_penalty(client_fd, msg->getPoint(), msg->getValue());
-    }
+    if (player.window > 0) {
+        // A put without a credit is not applied, the window stays as it is.
+        if (player.credits == 0) {
+            log.early_put(client_fd, msg.point, msg.value);
+            respond_with_penalty(client_fd, msg.point, msg.value);
+            return false;
+        }
+        player.credits--;
+    } else {
+        if (!player.can_put) {
+            successful_put = false;
+            log.early_put(client_fd, msg.point, msg.value);
+            respond_with_penalty(client_fd, msg.point, msg.value);
+        }
 
-    player.can_put = false;
+        player.can_put = false;
+    }
 
-    if (msg->getPoint() < 0 || msg->getPoint() > K ||
-        msg->getValue() + constants::eps < constants::min_put_value ||
-        msg->getValue() - constants::eps > constants::max_put_value) {
+    if (msg.point < 0 || msg.point > rooms[player.room].K ||
+        msg.value + constants::eps < constants::min_put_value ||
+        msg.value - constants::eps > constants::max_put_value) {
         successful_put = false;
-        std::cout << player.id << " tried to put " << msg->getValue() << " in "
-                  << msg->getPoint() << " which is out of range." << std::endl;
-        respond_with_bad_put(client_fd, msg->getPoint(), msg->getValue());
+        log.bad_put(client_fd, msg.point, msg.value);
+        respond_with_bad_put(client_fd, msg.point, msg.value);
     }
 
     if (!successful_put) {
@@ -182,21 +277,18 @@ bool ServerLogic::handle_put(int client_fd, PutMessage* msg) {
     }
 
     player.correct_puts++;
-    total_correct_puts++;
-    player.approximations[msg->getPoint()] += msg->getValue();
 
-    std::unique_ptr<Message> state_msg =
-        StateMessage::createMessage(this->players[client_fd].approximations);
+    // Only the squared difference in the put point changes.
+    double real_value = player.real_values[msg.point];
+    double old_difference = real_value - player.approximations[msg.point];
+    player.approximations[msg.point] += msg.value;
+    double new_difference = real_value - player.approximations[msg.point];
+    player.squared_error += (long double)new_difference * new_difference -
+                            (long double)old_difference * old_difference;
 
-    std::cout << player.id << " puts " << msg->getValue() << " in " << msg->getPoint()
-              << ", current state "
-              << state_msg->toRawString().substr(std::string("STATE ").length()) << std::endl;
+    respond_with_state(client_fd, msg.point, msg.value);
 
-    respond_with_state(client_fd, state_msg->getRawMessage());
-
-    if (total_correct_puts >= M) {
-        game_over();
-    }
+    coordinator.add_correct_puts(player.room, 1);
 
     return true;
 }
@@ -205,101 +297,246 @@ void ServerLogic::respond_with_penalty(int client_fd, int point, double value) {
     PlayerInfo& player = players[client_fd];
     player.penalty += constants::early_put_penalty;
     player.can_put = true;
-    std::unique_ptr<Message> penalty_msg = PenaltyMessage::createMessage(point, value);
-    append_message_back(client_fd, penalty_msg->getRawMessage());
+    append_message_back(client_fd, MessageParser::formatMessage(PenaltyMessage{point, value}));
 }
 
 void ServerLogic::respond_with_bad_put(int client_fd, int point, double value) {
     PlayerInfo& player = players[client_fd];
     player.penalty += constants::bad_put_penalty;
 
-    event_manager.add_event(
-        [this, client_fd, point, value, client_ip = this->getClientIP(client_fd),
-         client_port = this->getClientPort(client_fd),
-         client_id = this->getClientPlayerID(client_fd)]() {
-            if (!this->validate_client(client_fd, client_ip, client_port) ||
-                this->getClientPlayerID(client_fd) != client_id) {
-                return; // client disconnected
+    PlayerEvent& event = schedule_player_event(
+        client_fd, PlayerEventType::BAD_PUT,
+        event_manager.now() + std::chrono::seconds(constants::bad_put_delay));
+    event.point = point;
+    event.value = value;
+}
+
+// Players using the extension get only the changed value, which does not depend on K.
+void ServerLogic::respond_with_state(int client_fd, int point, double put_value) {
+    PlayerInfo& player = players[client_fd];
+    auto deadline = event_manager.now() + std::chrono::seconds(player.delay);
+
+    if (player.state_delta && player.state_deltas_left > 0) {
+        player.state_deltas_left--;
+        double value = player.approximations[point];
+        log.put_with_delta(client_fd, point, put_value, value);
+
+        PlayerEvent& event =
+            schedule_player_event(client_fd, PlayerEventType::STATE_DELTA, deadline);
+        event.point = point;
+        event.value = value;
+        event.message = MessageParser::formatMessage(StateDeltaMessage{point, value});
+        return;
+    }
+
+    player.state_deltas_left = constants::state_snapshot_interval - 1;
+    auto state_msg = std::make_shared<const std::string>(
+        MessageParser::formatStateMessage(player.approximations));
+    log.put_with_state(client_fd, point, put_value, state_msg);
+
+    PlayerEvent& event = schedule_player_event(client_fd, PlayerEventType::STATE, deadline);
+    event.state_message = std::move(state_msg);
+}
+
+PlayerEvent& ServerLogic::schedule_player_event(int client_fd, PlayerEventType type,
+                                                GameClock::time_point deadline) {
+    PlayerEvent* event;
+    if (free_events.empty()) {
+        event = &event_pool.emplace_back();
+        event->set_callback(&ServerLogic::on_player_event);
+    } else {
+        event = free_events.back();
+        free_events.pop_back();
+    }
+
+    PlayerInfo& player = players[client_fd];
+    event->logic = this;
+    event->client_fd = client_fd;
+    event->connection_id = player.connection_id;
+    event->type = type;
+
+    if (player.window > 0 && type != PlayerEventType::HELLO_TIMEOUT) {
+        event->deadline = deadline;
+        event->next_response = nullptr;
+        if (player.last_response) {
+            player.last_response->next_response = event; // scheduled after the previous ones
+            player.last_response = event;
+            return *event;
+        }
+        player.first_response = player.last_response = event;
+    }
+
+    event_manager.schedule(*event, deadline);
+    return *event;
+}
+
+void ServerLogic::on_player_event(TimerNode& node) {
+    PlayerEvent& event = static_cast<PlayerEvent&>(node);
+    event.logic->handle_player_event(event);
+}
+
+void ServerLogic::handle_player_event(PlayerEvent& event) {
+    int client_fd = event.client_fd;
+    if (!validate_client(client_fd, event.connection_id)) {
+        release_event(event); // client disconnected, the payload is not sent
+        return;
+    }
+
+    PlayerInfo& player = players[client_fd];
+    if (event.type != PlayerEventType::HELLO_TIMEOUT && is_game_over(client_fd)) {
+        // The game of the room ended while the response was delayed, the client gets SCORING
+        // instead. With a window, the event is the first of the queued responses.
+        if (player.window > 0) {
+            release_responses(player);
+        } else {
+            release_event(event);
+        }
+        return;
+    }
+
+    switch (event.type) {
+        case PlayerEventType::HELLO_TIMEOUT:
+            player.hello_timeout = nullptr;
+            if (!player.is_known) {
+                log.hello_timeout(client_fd);
+                timed_out_clients.push_back(client_fd);
             }
-            PlayerInfo& player = this->players[client_fd];
+            break;
+        case PlayerEventType::BAD_PUT: {
             player.can_put = true;
-            std::unique_ptr<Message> bad_put_msg = BadPutMessage::createMessage(point, value);
-            this->append_message_back(client_fd, bad_put_msg->getRawMessage());
-        },
-        std::chrono::steady_clock::now() + std::chrono::seconds(constants::bad_put_delay));
-}
-
-void ServerLogic::respond_with_state(int client_fd, const std::string& state_msg) {
-    event_manager.add_event(
-        [this, client_fd, state_msg, client_ip = this->getClientIP(client_fd),
-         client_port = this->getClientPort(client_fd),
-         client_id = this->getClientPlayerID(client_fd)]() {
-            if (!this->validate_client(client_fd, client_ip, client_port) ||
-                this->getClientPlayerID(client_fd) != client_id) {
-                return; // client disconnected
-            }
-            this->append_message_back(client_fd, state_msg);
-            std::cout << "Sending state "
-                      << state_msg.substr(
-                             std::string("STATE ").length(),
-                             state_msg.find(constants::crlf) - std::string("STATE ").length())
-                      << " to " << client_id << "." << std::endl;
-            this->players[client_fd].can_put = true;
-        },
-        std::chrono::steady_clock::now() + std::chrono::seconds(players[client_fd].delay));
-}
-
-void ServerLogic::game_over() {
-    send_scoring_messages();
-    stopping = true;
-}
-
-void ServerLogic::send_scoring_messages() {
-    std::vector<std::string> ids{};
-    std::vector<double> scores{};
-
-    for (const auto& [client_fd, player] : players) {
-        if (player.is_known) {
-            ids.push_back(player.id);
-            scores.push_back(calculate_score(player));
+            BadPutMessage bad_put_msg{event.point, event.value};
+            append_message_back(client_fd, MessageParser::formatMessage(bad_put_msg));
+            break;
         }
+        case PlayerEventType::STATE:
+            log.sending_state(client_fd, event.state_message);
+            append_message_back(client_fd, std::move(event.state_message));
+            player.can_put = true;
+            break;
+        case PlayerEventType::STATE_DELTA:
+            log.sending_state_delta(client_fd, event.point, event.value);
+            append_message_back(client_fd, std::move(event.message));
+            player.can_put = true;
+            break;
     }
 
-    std::unique_ptr<Message> scoring_msg = ScoringMessage::createMessage(ids, scores);
-    for (const auto& [client_fd, player] : players) {
-        if (player.is_known) {
-            append_message_back(client_fd, scoring_msg->getRawMessage());
-        }
+    if (player.window > 0 && event.type != PlayerEventType::HELLO_TIMEOUT) {
+        player.credits++;
+        send_next_response(player);
+    }
+    free_events.push_back(&event);
+}
+
+// Schedules the response following the first one, which has just been sent. Its deadline
+// may have passed while it waited; then it is sent in this check of the timers.
+void ServerLogic::send_next_response(PlayerInfo& player) {
+    player.first_response = player.first_response->next_response;
+    if (player.first_response) {
+        event_manager.schedule(*player.first_response, player.first_response->deadline);
+    } else {
+        player.last_response = nullptr;
+    }
+}
+
+void ServerLogic::release_event(PlayerEvent& event) {
+    event_manager.cancel(event);
+    event.message = std::string();
+    event.state_message.reset();
+    free_events.push_back(&event);
+}
+
+// Responses of a player with a window are released with the player, the next ones are not
+// scheduled and would never be freed otherwise.
+void ServerLogic::release_responses(PlayerInfo& player) {
+    PlayerEvent* event = player.first_response;
+    while (event) {
+        PlayerEvent* next = event->next_response;
+        release_event(*event);
+        event = next;
+    }
+    player.first_response = player.last_response = nullptr;
+}
+
+void ServerLogic::collect_scores(int room, std::vector<std::string>& out_ids,
+                                 std::vector<double>& out_scores) const {
+    out_ids.clear();
+    out_scores.clear();
+    for (int client_fd : rooms[room].player_fds) {
+        const PlayerInfo& player = players[client_fd];
+        out_ids.push_back(player.id);
+        out_scores.push_back(calculate_score(player));
+    }
+}
+
+void ServerLogic::send_scoring_messages(int room,
+                                        const std::shared_ptr<const std::string>& scoring_msg) {
+    for (int client_fd : rooms[room].player_fds) {
+        append_message_back(client_fd, scoring_msg);
+    }
+}
+
+void ServerLogic::collect_leaderboard(int room, size_t count, std::vector<std::string>& out_ids,
+                                      std::vector<double>& out_scores) const {
+    std::vector<std::pair<double, int>> ranking; // (score, client_fd)
+    for (int client_fd : rooms[room].player_fds) {
+        ranking.emplace_back(calculate_score(players[client_fd]), client_fd);
     }
 
-    std::cout << "Game end, scoring: "
-              << scoring_msg->toRawString().substr(std::string("SCORING ").length())
-              << std::endl;
+    count = std::min(count, ranking.size());
+    if (count < ranking.size()) {
+        std::nth_element(ranking.begin(), ranking.begin() + count, ranking.end());
+    }
+    std::sort(ranking.begin(), ranking.begin() + count);
+
+    out_ids.clear();
+    out_scores.clear();
+    for (size_t i = 0; i < count; i++) {
+        out_ids.push_back(players[ranking[i].second].id);
+        out_scores.push_back(ranking[i].first);
+    }
 }
 
-double ServerLogic::calculate_score(const PlayerInfo& player) {
-    double score = 0.0;
-    for (int x = 0; x <= K; x++) {
-        double real_value = player_poly_at(player, x);
-        double approx_value = player.approximations[x];
-        score += (real_value - approx_value) * (real_value - approx_value);
+double ServerLogic::calculate_score(const PlayerInfo& player) const {
+    // Rounding of the updates may leave a tiny negative error instead of zero.
+    return (double)std::max(player.squared_error, 0.0L) + player.penalty;
+}
+
+// The event manager is shared with the event loop and other rooms, so only the events of
+// the players of the room are cancelled. All pooled events are visited; there are about as
+// many of them as players waiting for a response.
+void ServerLogic::end_game(int room) {
+    rooms[room].playing = false;
+    for (int client_fd : rooms[room].player_fds) {
+        release_responses(players[client_fd]);
+    }
+    for (PlayerEvent& event : event_pool) {
+        if (!event.is_scheduled() || !validate_client(event.client_fd, event.connection_id) ||
+            players[event.client_fd].room != room) {
+            continue;
+        }
+        release_event(event);
     }
-    return score + player.penalty;
 }
 
-double ServerLogic::player_poly_at(const PlayerInfo& player, int x) const {
-    double result = 0;
-    double x_pow = 1;
-    for (int i = 0; i <= N; i++) {
-        result += player.coefficients[i] * x_pow;
-        x_pow *= x;
+void ServerLogic::remove_players(int room) {
+    std::vector<int>& fds = rooms[room].player_fds;
+    for (int client_fd : fds) {
+        coordinator.leave_room(room);
+        players.erase(client_fd);
     }
-    return result;
+    fds.clear();
 }
 
-void ServerLogic::reset() {
-    event_manager.reset();
-    total_correct_puts = 0;
-    players.clear();
-    stopping = false;
+void ServerLogic::start_game(int room, std::vector<int>& out_fds) {
+    Room& r = rooms[room];
+    r.playing = true;
+    out_fds.clear();
+    out_fds.swap(r.waiting_fds);
+    for (int client_fd : out_fds) {
+        PlayerInfo& player = players[client_fd];
+        player.waiting = false;
+        player.room_position = r.player_fds.size();
+        r.player_fds.push_back(client_fd);
+        start_playing(client_fd);
+    }
 }
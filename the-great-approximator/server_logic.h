@@ -1,88 +1,186 @@
 #ifndef SERVER_LOGIC_H
 #define SERVER_LOGIC_H
 
+#include <sys/socket.h>
+
+#include <cstdint>
 #include <deque>
-#include <fstream>
-#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "arg_parser.h"
+#include "fd_table.h"
+#include "game_clock.h"
+#include "game_coordinator.h"
 #include "msg_parser.h"
+#include "output_queue.h"
 #include "server_events.h"
+#include "server_log.h"
+#include "trace.h"
+
+class ServerLogic;
+
+enum class PlayerEventType { HELLO_TIMEOUT, BAD_PUT, STATE, STATE_DELTA };
+
+// Deferred action concerning a single connection. Pooled by ServerLogic, so scheduling
+// a response does not allocate.
+struct PlayerEvent : TimerNode {
+    ServerLogic* logic;
+    int client_fd;
+    uint64_t connection_id;
+    PlayerEventType type;
+    int point;           // BAD_PUT and STATE_DELTA only
+    double value;        // BAD_PUT and STATE_DELTA only
+    std::string message; // STATE_DELTA only
+    std::shared_ptr<const std::string> state_message; // STATE only, shared with the log
+    // Responses to a player with a window wait in a list, in the order of the puts; only the
+    // first one is scheduled, the next one when it has been sent.
+    GameClock::time_point deadline;
+    PlayerEvent* next_response;
+};
 
 struct PlayerInfo {
+    uint64_t connection_id; // unique for the server lifetime, unlike the descriptor
+    PlayerEvent* hello_timeout; // pending until HELLO is received
     std::string id;
-    std::string ip;
-    int port;
-    std::deque<std::string> messages;
+    struct sockaddr_storage address; // formatted only when printed
+    int room;             // -1 until HELLO
+    size_t room_position; // in the player list of the room
+    bool waiting;         // joined the room between games, plays in the next one
+    OutputQueue messages;
     std::vector<double> approximations;
-    std::vector<double> coefficients;
+    std::vector<double> real_values; // polynomial at x = 0..K, computed when the game starts
+    // Sum of squared differences between the polynomial and approximations over all points,
+    // updated on every accepted put. Kept in extended precision, so that the updates do not
+    // drift from the sum computed from scratch.
+    long double squared_error;
     double penalty;
     bool is_known;
     int correct_puts;
     bool can_put;
+    int window;  // puts that may wait for responses at once, 0: one at a time (can_put)
+    int credits; // puts a player with a window may send now
+    PlayerEvent* first_response; // responses to a player with a window, in order
+    PlayerEvent* last_response;
     int delay; // number of small letters in player id
+    bool state_delta; // player asked for STATE_DELTA responses in HELLO
+    int state_deltas_left; // deltas to send before the next full STATE
 };
 
+// Players of one shard. HELLO places a player in a room chosen by the coordinator; K of
+// the room determines its points. The game of a room is ended and started again separately
+// on every shard, by end_game() and start_game(); players joining in between wait.
 class ServerLogic {
  public:
-    ServerLogic(int K, int N, int M, const std::string& file_name,
-                EventManager& event_manager);
+    // Output queues of the players are counted in output_gauge. Messages queued for the
+    // players are also recorded in trace, if given.
+    ServerLogic(GameCoordinator& coordinator, EventManager& event_manager,
+                OutputMemoryGauge& output_gauge, ShardLog& log, ShardTrace* trace = nullptr);
 
     // Dealing with clients.
-    void register_new_client(int client_fd, const std::string& ip, int port);
+    // Returns connection id of the new client.
+    uint64_t register_new_client(int client_fd, const struct sockaddr_storage& address);
     void handle_client_disconnect(int client_fd);
 
     // Dealing with messages.
-    bool has_pending_messages(int client_fd) const;
-    std::string take_next_message_str(int client_fd);
-    void append_message_front(int client_fd, const std::string& msg);
-    void append_message_back(int client_fd, const std::string& msg);
+    OutputQueue& getMessages(int client_fd);
+    void append_message_back(int client_fd, std::string msg);
+    void append_message_back(int client_fd, std::shared_ptr<const std::string> msg);
+
+    // Moves descriptors of clients whose message queue became non-empty since the last call
+    // into out_fds. Lets the event loop flush only those clients instead of scanning all.
+    void take_clients_with_new_messages(std::vector<int>& out_fds);
+
+    // Moves descriptors of clients that did not send HELLO in time into out_fds.
+    // The event loop is responsible for disconnecting them.
+    void take_timed_out_clients(std::vector<int>& out_fds);
 
     // Simple getters.
-    std::string getClientPlayerID(int client_fd) const;
-    std::string getClientIP(int client_fd) const;
+    const std::string& getClientPlayerID(int client_fd) const;
+    std::string getClientIP(int client_fd) const; // formatted on every call
     int getClientPort(int client_fd) const;
     const PlayerInfo& getPlayerInfo(int client_fd) const;
 
-    // Returns true if the server is stopping due to game over (#puts == M).
-    bool is_stopping() const;
+    // Returns whether client_fd refers to a registered client.
+    bool is_client_connected(int client_fd) const;
+
+    // Returns true if the game of the room of the client is over (#puts == M in all shards).
+    bool is_game_over(int client_fd) const;
+
+    // Players of the current game of the room on this shard, without the waiting ones.
+    const std::vector<int>& getRoomPlayerFds(int room) const;
+
+    // Collects scores of the players of the room for the coordinator.
+    void collect_scores(int room, std::vector<std::string>& out_ids,
+                        std::vector<double>& out_scores) const;
+
+    // Collects at most count players of the room with the lowest (best) scores so far, best
+    // first. Takes O(players + count log count) time, so it can be called during the game.
+    void collect_leaderboard(int room, size_t count, std::vector<std::string>& out_ids,
+                             std::vector<double>& out_scores) const;
+
+    // Queues the final SCORING message for the players of the room.
+    void send_scoring_messages(int room, const std::shared_ptr<const std::string>& scoring_msg);
 
     // Handles message from client.
     // Returns false if message was unexpected at this point.
-    bool handle_client_message(int client_fd, std::unique_ptr<Message> msg);
+    bool handle_client_message(int client_fd, const Message& msg);
+
+    // Stops the game of the room: cancels responses still to be sent to its players.
+    // Players joining the room from now on wait for start_game().
+    void end_game(int room);
 
-    // Resets the server state.
-    void reset();
+    // Removes the players of the room that played the ended game.
+    void remove_players(int room);
 
-    // Returns whether client_fd refers to a valid client with given IP and port.
+    // Starts the next game of the room for the waiting players: sends them coefficients.
+    // Their descriptors are stored in out_fds.
+    void start_game(int room, std::vector<int>& out_fds);
+
+    // Returns whether client_fd still refers to the connection with given id.
     // Useful when scheduling events in the future, when client might have disconnected.
-    bool validate_client(int client_fd, const std::string& ip, int port) const;
+    bool validate_client(int client_fd, uint64_t connection_id) const;
 
  private:
-    int K;
-    int N;
-    int M;
-    std::string file_name;
-    int total_correct_puts;
-    std::ifstream coeff_file;
-    std::map<int, PlayerInfo> players; // client_fd -> PlayerInfo
+    // Players of one room on this shard.
+    struct Room {
+        int K;
+        bool playing = true; // between end_game() and start_game() players wait
+        std::vector<int> player_fds;
+        std::vector<int> waiting_fds;
+    };
+
+    GameCoordinator& coordinator;
+    std::vector<Room> rooms;
+    FdTable<PlayerInfo> players; // client_fd -> PlayerInfo
+    uint64_t next_connection_id;
     EventManager& event_manager;
-    bool stopping;
+    OutputMemoryGauge& output_gauge;
+    ShardLog& log;
+    ShardTrace* trace;
+    std::vector<int> clients_with_new_messages;
+    std::vector<int> timed_out_clients;
+    std::deque<PlayerEvent> event_pool; // deque keeps addresses of scheduled events stable
+    std::vector<PlayerEvent*> free_events;
 
-    bool handle_hello(int client_fd, HelloMessage* msg);
-    bool handle_put(int client_fd, PutMessage* msg);
+    bool handle_hello(int client_fd, const HelloMessage& msg);
+    bool handle_put(int client_fd, const PutMessage& msg);
+    void start_playing(int client_fd);
+    void leave_room(int client_fd);
 
-    void game_over(); // called when #puts == M
     void respond_with_penalty(int client_fd, int point, double value);
     void respond_with_bad_put(int client_fd, int point, double value);
-    void respond_with_state(int client_fd, const std::string& state_msg);
-    void send_scoring_messages();
-    double calculate_score(const PlayerInfo& player);
-    double player_poly_at(const PlayerInfo& player, int x) const;
-    bool is_client_connected(int client_fd) const;
+    void respond_with_state(int client_fd, int point, double put_value);
+
+    PlayerEvent& schedule_player_event(int client_fd, PlayerEventType type,
+                                       GameClock::time_point deadline);
+    static void on_player_event(TimerNode& node);
+    void handle_player_event(PlayerEvent& event);
+    void send_next_response(PlayerInfo& player);
+    void release_event(PlayerEvent& event);
+    void release_responses(PlayerInfo& player);
+    double calculate_score(const PlayerInfo& player) const;
 };
 
 #endif // SERVER_LOGIC_H
\ No newline at end of file
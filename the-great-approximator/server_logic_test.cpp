@@ -0,0 +1,247 @@
+// Windowed puts of ServerLogic against a model of the credits: a player sends puts, in and
+// out of range, with and without credits, while the responses are released by the timers,
+// and every message it receives is compared with the one the model expects. The clock runs
+// 1000 times faster than real time, so that delays of seconds take milliseconds.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "constants.h"
+#include "err.h"
+#include "game_clock.h"
+#include "game_coordinator.h"
+#include "line_framer.h"
+#include "msg_parser.h"
+#include "server_events.h"
+#include "server_log.h"
+#include "server_logic.h"
+#include "test.h"
+
+namespace {
+
+constexpr int time_scale = 1000;
+constexpr int k = 10;
+constexpr int steps = 3000;
+
+// One player over a socket pair: the server side is the descriptor registered in
+// ServerLogic, the messages queued for it are flushed to the socket and read back here.
+class WindowTest {
+ public:
+    WindowTest(const std::string& coeff_file, const std::string& player_id, int window,
+               int m = constants::max_m)
+        : coordinator({RoomConfig{k, 3, m}}, 0, coeff_file, 1, false),
+          clock(time_scale),
+          event_manager(clock),
+          log(LogLevel::GAMES, 1),
+          logic(coordinator, event_manager, coordinator.getGauges(0).output_memory, log),
+          window(window),
+          outstanding(),
+          input() {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+            syserr("socketpair");
+        }
+        struct sockaddr_storage address = {};
+        struct sockaddr_in* ipv4 = (struct sockaddr_in*)&address;
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ipv4->sin_port = htons(10000);
+        logic.register_new_client(fds[0], address);
+        logic.handle_client_message(fds[0], HelloMessage{player_id, false, -1, window});
+    }
+
+    ~WindowTest() {
+        logic.end_game(0); // cancels the responses scheduled in event_manager
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    // Returns the messages sent to the player since the last call.
+    std::vector<std::string> receive() {
+        logic.getMessages(fds[0]).flush(fds[0], SIZE_MAX);
+        std::vector<std::string> lines;
+        while (true) {
+            char* free_space = input.prepare();
+            ssize_t bytes_read = recv(fds[1], free_space, input.writable(), 0);
+            if (bytes_read <= 0) {
+                break;
+            }
+            input.commit(bytes_read);
+        }
+        std::string_view line;
+        while (input.next_line(line)) {
+            lines.emplace_back(line);
+        }
+        return lines;
+    }
+
+    void put(int point, double value) {
+        logic.handle_client_message(fds[0], PutMessage{point, value});
+    }
+
+    // Waits for the next response to be due and releases it.
+    void advance() {
+        int timeout_ms = event_manager.next_timeout_ms();
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms > 0 ? timeout_ms : 1));
+        event_manager.check_timers();
+    }
+
+    GameCoordinator coordinator;
+    GameClock clock;
+    EventManager event_manager;
+    ShardLog log;
+    ServerLogic logic;
+    int window;
+    std::deque<std::string> outstanding; // responses expected, in the order of the puts
+    LineFramer input;
+    int fds[2];
+};
+
+std::string command(const std::string& line) {
+    return line.substr(0, line.find(' '));
+}
+
+// The line the server sends for msg, without its end.
+std::string line_of(const Message& msg) {
+    std::string line = MessageParser::formatMessage(msg);
+    line.resize(line.size() - constants::crlf.size());
+    return line;
+}
+
+// The whole BAD_PUT for puts out of range, only the command of the STATE for the others.
+std::string expected_response(int point, double value) {
+    if (point < 0 || point > k) {
+        return line_of(BadPutMessage{point, value});
+    }
+    return "STATE";
+}
+
+void test_handshake(const std::string& coeff_file) {
+    WindowTest test(coeff_file, "P", 1000);
+    std::vector<std::string> lines = test.receive();
+    CHECK(lines.size() == 2);
+    CHECK(lines.size() == 2 && command(lines[0]) == "COEFF" &&
+          lines[1] == "WINDOW " + std::to_string(constants::max_put_window));
+}
+
+// Responses come in the order of the puts, also when a later one is due earlier: a put
+// out of range is answered after a second, a state after one second per small letter.
+void test_order(const std::string& coeff_file) {
+    WindowTest test(coeff_file, "Pabc", 4);
+    test.receive();
+
+    test.put(1, 1.0);
+    test.put(k + 1, 1.0);
+    test.put(2, 1.0);
+    test.put(-1, 2.0);
+    test.put(3, 1.0); // no credit left
+    std::vector<std::string> lines = test.receive();
+    CHECK(lines.size() == 1 && lines[0] == line_of(PenaltyMessage{3, 1.0}));
+
+    std::vector<std::string> responses;
+    while (responses.size() < 4) {
+        test.advance();
+        for (const std::string& line : test.receive()) {
+            responses.push_back(command(line) == "STATE" ? "STATE" : line);
+        }
+    }
+    CHECK(responses == std::vector<std::string>({"STATE", expected_response(k + 1, 1.0), "STATE",
+                                                 expected_response(-1, 2.0)}));
+    CHECK(test.event_manager.next_timeout_ms() == -1);
+
+    // All credits are back.
+    for (int i = 0; i < 4; i++) {
+        test.put(i, 0.5);
+    }
+    CHECK(test.receive().empty());
+}
+
+void test_random_puts(const std::string& coeff_file) {
+    std::mt19937_64 rng(2024);
+    WindowTest test(coeff_file, "Pa", 3);
+    test.receive();
+
+    for (int step = 0; step < steps; step++) {
+        std::vector<std::string> expected_now; // sent at once
+        if (rng() % 3 == 0) {
+            test.advance();
+        } else {
+            int point = (int)(rng() % (k + 3)) - 1;
+            double value = (int)(rng() % 11 - 5) / 2.0;
+            test.put(point, value);
+            if ((int)test.outstanding.size() == test.window) {
+                expected_now.push_back(line_of(PenaltyMessage{point, value}));
+            } else {
+                test.outstanding.push_back(expected_response(point, value));
+            }
+        }
+
+        for (const std::string& line : test.receive()) {
+            if (command(line) == "PENALTY") {
+                CHECK(!expected_now.empty() && line == expected_now.front());
+                if (!expected_now.empty()) {
+                    expected_now.erase(expected_now.begin());
+                }
+                continue;
+            }
+            std::string response = command(line) == "STATE" ? "STATE" : line;
+            CHECK(!test.outstanding.empty() && response == test.outstanding.front());
+            if (!test.outstanding.empty()) {
+                test.outstanding.pop_front();
+            }
+        }
+        CHECK(expected_now.empty());
+    }
+}
+
+// A put that ends the game leaves its response scheduled until the shard ends the game;
+// a response due before that is not sent, the player gets SCORING instead.
+void test_game_over(const std::string& coeff_file) {
+    for (int window : {0, 4}) {
+        WindowTest test(coeff_file, "P", window, 1);
+        test.receive();
+
+        test.put(1, 1.0);
+        if (window > 0) {
+            test.put(2, 1.0);
+        }
+        CHECK(test.coordinator.is_game_over(0));
+        test.advance();
+        CHECK(test.receive().empty());
+        CHECK(test.event_manager.next_timeout_ms() == -1);
+    }
+}
+
+} // namespace
+
+void test_server_logic() {
+    char file_name[] = "/tmp/approx-test-XXXXXX";
+    int fd = mkstemp(file_name);
+    if (fd < 0) {
+        syserr("mkstemp");
+    }
+    std::string coefficients;
+    for (int i = 0; i < 10; i++) {
+        coefficients += "COEFF 1.5 -2.25 0.125 3" + constants::crlf;
+    }
+    if (write(fd, coefficients.data(), coefficients.size()) != (ssize_t)coefficients.size()) {
+        syserr("write");
+    }
+    close(fd);
+
+    test_handshake(file_name);
+    test_order(file_name);
+    test_random_puts(file_name);
+    test_game_over(file_name);
+    unlink(file_name);
+}
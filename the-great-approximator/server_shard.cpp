@@ -0,0 +1,590 @@
+#include "server_shard.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "err.h"
+#include "msg_parser.h"
+#include "networking.h"
+
+ServerShard::ServerShard(const ServerArgParser& args, GameCoordinator& coordinator,
+                         ServerLog& server_log, const GameClock& clock, int shard_index,
+                         int listening_fd, TraceFile* trace_file)
+    : shard_index(shard_index),
+      shard_count(args.getReactors()),
+      listening_fd(listening_fd),
+      accept_batch(args.getAcceptBatch()),
+      connections_pending(false),
+      accepting_paused(false),
+      wakeup_fd(coordinator.getWakeupFd(shard_index)),
+      coordinator(coordinator),
+      log(server_log.getShardLog(shard_index)),
+      gauges(coordinator.getGauges(shard_index)),
+      output_soft_limit(args.getOutputSoftLimit()),
+      output_hard_limit(args.getOutputHardLimit()),
+      reactor(Reactor::create(args.getBackend())),
+      trace(trace_file ? std::make_unique<ShardTrace>(*trace_file) : nullptr),
+      event_manager(clock),
+      server_logic(coordinator, event_manager, gauges.output_memory, log, trace.get()),
+      connections(),
+      clients_to_flush(),
+      clients_over_budget(),
+      clients_to_disconnect(),
+      clients_to_resume(),
+      started_clients(),
+      incoming_message(),
+      room_count(coordinator.getRoomCount()),
+      rooms(std::make_unique<Room[]>(room_count)),
+      rooms_to_check(false),
+      leaderboard_interval(args.getLeaderboardInterval()),
+      leaderboard_timer() {
+    for (int i = 0; i < room_count; i++) {
+        rooms[i].next_game_timer.shard = this;
+        rooms[i].next_game_timer.room = i;
+        rooms[i].next_game_timer.set_callback(&ServerShard::on_next_game_timer);
+    }
+    leaderboard_timer.shard = this;
+    leaderboard_timer.room = -1;
+    leaderboard_timer.set_callback(&ServerShard::on_leaderboard_timer);
+    if (leaderboard_interval > 0) {
+        event_manager.schedule(leaderboard_timer,
+                               event_manager.now() + std::chrono::seconds(leaderboard_interval));
+    }
+    reactor->add(listening_fd, false);
+    reactor->add(wakeup_fd, false);
+}
+
+void ServerShard::disconnect_client(int client_fd) {
+    log.disconnect(client_fd);
+    if (trace) {
+        trace->disconnect(client_fd);
+    }
+    server_logic.handle_client_disconnect(client_fd);
+    set_reads_paused(client_fd, false);
+    if (!connections[client_fd].unwatched) {
+        reactor->remove(client_fd);
+    }
+    close(client_fd);
+    connections.erase(client_fd);
+    resume_accepting();
+}
+
+void ServerShard::register_client(int client_fd, const struct sockaddr_storage& address) {
+    // Initially we only want to read (HELLO) from client.
+    reactor->add(client_fd, false);
+
+    if (trace) {
+        trace->connect(client_fd);
+    }
+    server_logic.register_new_client(client_fd, address);
+    connections.insert(client_fd);
+}
+
+// Accepts pending connections, at most accept_batch of them, so that a burst of new
+// connections does not hold up the players already connected. The edge-triggered reactor
+// reports the listening socket only once, so while connections may be left in the backlog
+// the loop comes back here without waiting (connections_pending).
+// Connections are accepted also between games, their players join a room on HELLO.
+void ServerShard::handle_new_connections() {
+    for (int accepted = 0; accepted < accept_batch; accepted++) {
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+
+        int client_fd = accept_new_connection(listening_fd, &client_addr, &client_addr_len);
+        if (client_fd < 0) {
+            connections_pending = false;
+            if (errno != 0) {
+                // Out of descriptors or memory. The connections wait in the backlog until a
+                // client disconnects; the listening socket would keep waking the loop.
+                error("could not accept a connection");
+                reactor->remove(listening_fd);
+                accepting_paused = true;
+            }
+            return;
+        }
+
+        register_client(client_fd, client_addr);
+    }
+    connections_pending = true;
+}
+
+void ServerShard::resume_accepting() {
+    if (accepting_paused) {
+        accepting_paused = false;
+        reactor->add(listening_fd, false);
+        connections_pending = true;
+    }
+}
+
+// Handles complete lines already received and reads until the socket is drained.
+// Stops early when the output queue of the client goes over the soft limit: the rest of the
+// input stays in the socket (or in the framer) until the client has read enough. The same
+// happens when the game of its room is over, or when the player has to wait for the next
+// one.
+// Returns whether the client is still connected
+bool ServerShard::handle_read_from_client(int client_fd) {
+    while (true) {
+        LineFramer& input = connections[client_fd].input;
+        std::string_view line;
+        while (input.next_line(line)) {
+            if (trace) {
+                trace->line_in(client_fd, line);
+            }
+            if (!MessageParser::parseMessage(line, incoming_message) ||
+                !server_logic.handle_client_message(client_fd, incoming_message)) {
+                error("bad message from [%s]:%d, %s: %.*s",
+                      server_logic.getClientIP(client_fd).c_str(),
+                      server_logic.getClientPort(client_fd),
+                      server_logic.getClientPlayerID(client_fd).c_str(), (int)line.size(),
+                      line.data());
+            }
+
+            if (!server_logic.getPlayerInfo(client_fd).is_known) {
+                if (getMessageType(incoming_message) != MessageType::HELLO) {
+                    log.message_before_hello(); // a rejected HELLO is logged by server_logic
+                }
+                disconnect_client(client_fd);
+                return false;
+            }
+
+            if (server_logic.getPlayerInfo(client_fd).waiting) {
+                unwatch_client(client_fd);
+                return true;
+            }
+
+            if (server_logic.is_game_over(client_fd)) {
+                return true;
+            }
+
+            if (server_logic.getMessages(client_fd).size() > output_soft_limit) {
+                set_reads_paused(client_fd, true);
+                return true;
+            }
+        }
+
+        if (input.take_dropped_lines() > 0) {
+            error("line too long from [%s]:%d, %s", server_logic.getClientIP(client_fd).c_str(),
+                  server_logic.getClientPort(client_fd),
+                  server_logic.getClientPlayerID(client_fd).c_str());
+            if (!server_logic.getPlayerInfo(client_fd).is_known) {
+                log.message_before_hello();
+                disconnect_client(client_fd);
+                return false;
+            }
+        }
+
+        char* free_space = input.prepare();
+        ssize_t bytes_read = recv(client_fd, free_space, input.writable(), 0);
+
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = 0; // so that later error() calls do not report it
+                return true; // nothing more to read for now
+            } else if (errno == EINTR) {
+                continue;
+            }
+            error("error reading from client %s",
+                  server_logic.getClientPlayerID(client_fd).c_str());
+            disconnect_client(client_fd);
+            return false;
+        } else if (bytes_read == 0) {
+            disconnect_client(client_fd);
+            return false;
+        }
+
+        // successful read from client
+        input.commit(bytes_read);
+    }
+}
+
+// Sends pending messages until the queue is empty, the socket buffer is full or the
+// per-iteration budget is used up; in the last case the client is flushed again in the
+// next iteration, since an edge-triggered reactor will not report it.
+// Then applies the output limits: a client whose queue stays above the hard limit is
+// disconnected, reads from a client above the soft limit are paused until it has read
+// the queue down to half of the limit.
+// Returns whether the client is still connected
+bool ServerShard::handle_write_to_client(int client_fd) {
+    OutputQueue& messages = server_logic.getMessages(client_fd);
+    switch (messages.flush(client_fd, constants::write_budget)) {
+        case OutputQueue::FlushResult::DONE:
+        case OutputQueue::FlushResult::BLOCKED: break;
+        case OutputQueue::FlushResult::BUDGET: clients_over_budget.push_back(client_fd); break;
+        case OutputQueue::FlushResult::ERROR:
+            error("error writing to client %s",
+                  server_logic.getClientPlayerID(client_fd).c_str());
+            disconnect_client(client_fd);
+            return false;
+    }
+
+    size_t queued = messages.size();
+    if (queued > output_hard_limit) {
+        error("client %s does not read its messages, %zu bytes queued",
+              server_logic.getClientPlayerID(client_fd).c_str(), queued);
+        gauges.evicted_clients.fetch_add(1, std::memory_order_relaxed);
+        disconnect_client(client_fd);
+        return false;
+    }
+
+    if (queued > output_soft_limit) {
+        set_reads_paused(client_fd, true);
+    } else if (connections[client_fd].reads_paused && queued <= output_soft_limit / 2) {
+        set_reads_paused(client_fd, false);
+        clients_to_resume.push_back(client_fd);
+    }
+
+    reactor->set_write_interest(client_fd, !messages.empty());
+    return true;
+}
+
+void ServerShard::set_reads_paused(int client_fd, bool paused) {
+    Connection& connection = connections[client_fd];
+    if (connection.reads_paused == paused) {
+        return;
+    }
+    connection.reads_paused = paused;
+    if (!connection.unwatched) {
+        reactor->set_read_interest(client_fd, !paused);
+    }
+    if (paused) {
+        gauges.paused_clients.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        gauges.paused_clients.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void ServerShard::unwatch_client(int client_fd) {
+    Connection& connection = connections[client_fd];
+    if (!connection.unwatched) {
+        reactor->remove(client_fd);
+        connection.unwatched = true;
+    }
+}
+
+// Handles input that arrived while reads from the clients were paused, or while they waited
+// for a game; an edge-triggered reactor does not report it again.
+void ServerShard::resume_reads() {
+    for (int client_fd : clients_to_resume) {
+        if (server_logic.is_client_connected(client_fd) &&
+            !connections[client_fd].reads_paused && !connections[client_fd].unwatched &&
+            !server_logic.is_game_over(client_fd)) {
+            handle_read_from_client(client_fd);
+        }
+    }
+    clients_to_resume.clear();
+}
+
+// Tries to send messages queued since the last iteration (responses and timer events),
+// and to continue sending to clients that used up their budget.
+void ServerShard::flush_clients_with_new_messages() {
+    resume_reads();
+    server_logic.take_clients_with_new_messages(clients_to_flush);
+    clients_to_flush.insert(clients_to_flush.end(), clients_over_budget.begin(),
+                            clients_over_budget.end());
+    clients_over_budget.clear();
+    for (int client_fd : clients_to_flush) {
+        if (connections.contains(client_fd) && connections[client_fd].closing) {
+            flush_closing_client(client_fd);
+        } else if (server_logic.is_client_connected(client_fd) &&
+                   !connections[client_fd].unwatched) {
+            handle_write_to_client(client_fd);
+        }
+    }
+}
+
+void ServerShard::drain_wakeup_fd() {
+    uint64_t count;
+    if (read(wakeup_fd, &count, sizeof(count)) < 0) {
+        errno = 0; // EAGAIN, already drained
+    }
+}
+
+// Called after the wakeup descriptor was readable or a game started: any room may have
+// ended its game or got its scoring.
+void ServerShard::check_rooms() {
+    rooms_to_check = false;
+    for (int room = 0; room < room_count; room++) {
+        if (rooms[room].phase == Phase::PLAYING && coordinator.is_game_over(room)) {
+            submit_scores(room);
+        }
+        if (rooms[room].phase == Phase::WAITING_FOR_SCORING) {
+            finish_game_if_scored(room);
+        }
+    }
+}
+
+// Called when the game of the room is over. Its players are not served until all shards
+// have submitted their scores, so they are unwatched; otherwise a level-triggered reactor
+// would keep reporting them. New connections are still accepted and other rooms play on.
+void ServerShard::submit_scores(int room) {
+    for (int client_fd : server_logic.getRoomPlayerFds(room)) {
+        unwatch_client(client_fd);
+    }
+    server_logic.end_game(room);
+
+    std::vector<std::string> ids;
+    std::vector<double> scores;
+    server_logic.collect_scores(room, ids, scores);
+    rooms[room].submitted_game = coordinator.submit_scores(room, ids, scores, log);
+    rooms[room].phase = Phase::WAITING_FOR_SCORING;
+}
+
+// Queues SCORING for the players of the room and hands their connections over to the
+// closing path: the output is sent through the reactor like during the game, and each
+// connection is closed once its output is sent and the client has closed its side. The
+// players are removed from the room right away and its next game starts after
+// constants::reset_delay; connections still open then are closed.
+void ServerShard::finish_game_if_scored(int room) {
+    std::shared_ptr<const std::string> scoring_msg;
+    if (!coordinator.take_scoring(room, rooms[room].submitted_game, scoring_msg)) {
+        return;
+    }
+
+    server_logic.send_scoring_messages(room, scoring_msg);
+    for (int client_fd : server_logic.getRoomPlayerFds(room)) {
+        Connection& connection = connections[client_fd];
+        connection.closing = true;
+        connection.closing_room = room;
+        connection.output = std::move(server_logic.getMessages(client_fd));
+        rooms[room].closing_clients.push_back(client_fd);
+        reactor->add(client_fd, true);
+        connection.unwatched = false;
+        set_reads_paused(client_fd, false); // input is discarded from now on
+    }
+    server_logic.remove_players(room);
+
+    rooms[room].phase = Phase::PAUSED;
+    event_manager.schedule(rooms[room].next_game_timer,
+                           event_manager.now() +
+                               std::chrono::milliseconds(constants::reset_delay));
+}
+
+void ServerShard::on_next_game_timer(TimerNode& node) {
+    ShardTimer& timer = static_cast<ShardTimer&>(node);
+    timer.shard->start_next_game(timer.room);
+}
+
+// Players that joined the room in the meantime start playing; input they sent while
+// waiting is handled now.
+void ServerShard::start_next_game(int room) {
+    for (int client_fd : rooms[room].closing_clients) {
+        if (connections.contains(client_fd) && connections[client_fd].closing &&
+            connections[client_fd].closing_room == room) {
+            close_closing_client(client_fd); // did not finish in time
+        }
+    }
+    rooms[room].closing_clients.clear();
+
+    rooms[room].phase = Phase::PLAYING;
+    server_logic.start_game(room, started_clients);
+    for (int client_fd : started_clients) {
+        reactor->add(client_fd, false);
+        connections[client_fd].unwatched = false;
+        clients_to_resume.push_back(client_fd);
+    }
+    // The next game may be over already if other shards started it earlier.
+    rooms_to_check = true;
+}
+
+void ServerShard::handle_closing_client(int client_fd, uint32_t events) {
+    if (events & reactor_events::hangup) {
+        close_closing_client(client_fd);
+        return;
+    }
+
+    if (events & (reactor_events::readable | reactor_events::error)) {
+        if (!discard_input(client_fd)) {
+            return;
+        }
+    }
+
+    if (events & reactor_events::writable) {
+        flush_closing_client(client_fd);
+    }
+}
+
+// Input of a closing connection is read only so that closing it does not reset the
+// connection (which could destroy SCORING not yet read by the client).
+// Returns whether the connection is still open
+bool ServerShard::discard_input(int client_fd) {
+    LineFramer& input = connections[client_fd].input;
+    while (true) {
+        input.clear();
+        char* free_space = input.prepare();
+        ssize_t bytes_read = recv(client_fd, free_space, input.writable(), 0);
+
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = 0;
+                return true;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            errno = 0;
+        }
+
+        if (bytes_read <= 0) { // the client is gone or has closed its side
+            close_closing_client(client_fd);
+            return false;
+        }
+    }
+}
+
+// Once all output is sent, the write side is shut down; the client reads SCORING and closes
+// the connection.
+// Returns whether the connection is still open
+bool ServerShard::flush_closing_client(int client_fd) {
+    Connection& connection = connections[client_fd];
+    if (connection.write_shut_down) {
+        return true;
+    }
+
+    switch (connection.output.flush(client_fd, constants::write_budget)) {
+        case OutputQueue::FlushResult::DONE:
+            shutdown(client_fd, SHUT_WR);
+            connection.write_shut_down = true;
+            break;
+        case OutputQueue::FlushResult::BLOCKED: break;
+        case OutputQueue::FlushResult::BUDGET: clients_over_budget.push_back(client_fd); break;
+        case OutputQueue::FlushResult::ERROR:
+            errno = 0;
+            close_closing_client(client_fd);
+            return false;
+    }
+
+    reactor->set_write_interest(client_fd, !connection.output.empty());
+    return true;
+}
+
+void ServerShard::close_closing_client(int client_fd) {
+    if (trace) {
+        trace->disconnect(client_fd);
+    }
+    reactor->remove(client_fd);
+    close(client_fd);
+    connections.erase(client_fd);
+    resume_accepting();
+}
+
+void ServerShard::on_leaderboard_timer(TimerNode& node) {
+    static_cast<ShardTimer&>(node).shard->log_leaderboards();
+}
+
+// Logs the best players so far of every room playing a game. The scores are running totals,
+// so this does not recompute anything; with several shards every shard logs its own players.
+void ServerShard::log_leaderboards() {
+    std::vector<std::string> ids;
+    std::vector<double> scores;
+    for (int room = 0; room < room_count; room++) {
+        if (rooms[room].phase != Phase::PLAYING) {
+            continue;
+        }
+        server_logic.collect_leaderboard(room, constants::leaderboard_size, ids, scores);
+        if (ids.empty()) {
+            continue;
+        }
+
+        std::string line = "Leaderboard";
+        if (room_count > 1) {
+            line += " of room " + std::to_string(room);
+        }
+        if (shard_count > 1) {
+            line += " on shard " + std::to_string(shard_index);
+        }
+        // Best first, otherwise formatted like the scores of SCORING.
+        line += ":";
+        for (size_t i = 0; i < ids.size(); i++) {
+            line += " " + ids[i] + " " + MessageParser::doubleToString(scores[i]);
+        }
+        log.text(line);
+    }
+
+    event_manager.schedule(leaderboard_timer,
+                           event_manager.now() + std::chrono::seconds(leaderboard_interval));
+}
+
+void ServerShard::run() {
+    while (true) {
+        // Sleep exactly until the next scheduled event, unless there is output left to
+        // send or input left to read.
+        int timeout_ms =
+            clients_over_budget.empty() && clients_to_resume.empty() && !connections_pending
+                ? event_manager.next_timeout_ms()
+                : 0;
+        const std::vector<ReadyEvent>& events = reactor->wait(timeout_ms);
+
+        event_manager.check_timers();
+        server_logic.take_timed_out_clients(clients_to_disconnect);
+        for (int client_fd : clients_to_disconnect) {
+            disconnect_client(client_fd);
+        }
+
+        for (const ReadyEvent& event : events) {
+            if (event.fd == listening_fd) {
+                // Accepted after client events, so that a reused fd never gets
+                // an event meant for the disconnected client.
+                connections_pending = true;
+                continue;
+            }
+
+            if (event.fd == wakeup_fd) {
+                drain_wakeup_fd(); // the rooms are checked below
+                rooms_to_check = true;
+                continue;
+            }
+
+            if (connections.contains(event.fd) && connections[event.fd].closing) {
+                handle_closing_client(event.fd, event.events);
+                continue;
+            }
+
+            if (!server_logic.is_client_connected(event.fd) ||
+                connections[event.fd].unwatched || server_logic.is_game_over(event.fd)) {
+                continue; // disconnected earlier in this iteration, or the game is over
+            }
+
+            if (event.events & reactor_events::hangup) {
+                disconnect_client(event.fd);
+                continue;
+            }
+
+            if ((event.events & (reactor_events::readable | reactor_events::error)) &&
+                !connections[event.fd].reads_paused) {
+                if (!handle_read_from_client(event.fd)) {
+                    continue;
+                }
+            }
+
+            if (connections[event.fd].unwatched || server_logic.is_game_over(event.fd)) {
+                continue;
+            }
+
+            if (event.events & reactor_events::writable) {
+                handle_write_to_client(event.fd);
+            }
+        }
+
+        if (connections_pending) {
+            handle_new_connections();
+        }
+
+        if (rooms_to_check) {
+            check_rooms();
+        }
+
+        flush_clients_with_new_messages();
+        if (trace) {
+            trace->flush();
+        }
+    } // main server loop
+}
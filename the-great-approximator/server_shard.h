@@ -0,0 +1,131 @@
+#ifndef SERVER_SHARD_H
+#define SERVER_SHARD_H
+
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "arg_parser.h"
+#include "constants.h"
+#include "fd_table.h"
+#include "game_clock.h"
+#include "game_coordinator.h"
+#include "line_framer.h"
+#include "msg_parser.h"
+#include "output_queue.h"
+#include "reactor.h"
+#include "server_events.h"
+#include "server_log.h"
+#include "server_logic.h"
+#include "trace.h"
+
+// Event loop serving the clients accepted on one listening socket.
+// Every shard runs in its own thread and owns its reactor, connections, timers and players;
+// the only state shared with other shards is the GameCoordinator.
+// The rooms go through the phases of their games independently: while one room waits for
+// its scoring, players of the other rooms keep playing.
+class ServerShard {
+ public:
+    // Timers run on clock. Traffic is captured to trace_file, if given.
+    ServerShard(const ServerArgParser& args, GameCoordinator& coordinator, ServerLog& server_log,
+                const GameClock& clock, int shard_index, int listening_fd,
+                TraceFile* trace_file = nullptr);
+    ServerShard(const ServerShard&) = delete;
+    ServerShard& operator=(const ServerShard&) = delete;
+
+    // Serves clients forever.
+    [[noreturn]] void run();
+
+ private:
+    enum class Phase {
+        PLAYING,
+        WAITING_FOR_SCORING, // game is over, scores are submitted
+        PAUSED,              // SCORING is being sent, the next game starts on a timer
+    };
+
+    struct Connection {
+        LineFramer input{constants::max_client_line_length};
+        // Set when the game of the connection ended. The rest of its output (SCORING) is
+        // sent from output, then the connection is closed.
+        bool closing = false;
+        int closing_room = -1;
+        bool write_shut_down = false;
+        bool reads_paused = false; // the output queue of the player went over the soft limit
+        // Removed from the reactor while the player waits for the next game of its room,
+        // or for the scoring of the game that is over.
+        bool unwatched = false;
+        OutputQueue output;
+    };
+
+    struct ShardTimer : TimerNode {
+        ServerShard* shard;
+        int room;
+    };
+
+    // State of the game of one room in this shard.
+    struct Room {
+        Phase phase = Phase::PLAYING;
+        uint64_t submitted_game = 0;
+        std::vector<int> closing_clients; // may contain descriptors closed already
+        ShardTimer next_game_timer;
+    };
+
+    int shard_index;
+    int shard_count;
+    int listening_fd;
+    int accept_batch;         // connections accepted per loop iteration
+    bool connections_pending; // may be left in the backlog of listening_fd
+    bool accepting_paused;    // listening_fd removed from the reactor, out of descriptors
+    int wakeup_fd;
+    GameCoordinator& coordinator;
+    ShardLog& log;
+    ShardGauges& gauges;
+    size_t output_soft_limit; // bytes
+    size_t output_hard_limit; // bytes
+    std::unique_ptr<Reactor> reactor;
+    std::unique_ptr<ShardTrace> trace; // null if the traffic is not captured
+    EventManager event_manager;
+    ServerLogic server_logic;
+    FdTable<Connection> connections;
+    std::vector<int> clients_to_flush;
+    std::vector<int> clients_over_budget; // stopped sending because of the write budget
+    std::vector<int> clients_to_disconnect;
+    std::vector<int> clients_to_resume; // reads resumed, input may be waiting
+    std::vector<int> started_clients;
+    Message incoming_message; // reused for every received line
+    int room_count;
+    std::unique_ptr<Room[]> rooms;
+    bool rooms_to_check; // the state of some room may have changed
+    int leaderboard_interval; // seconds of game time, 0: no leaderboards are logged
+    ShardTimer leaderboard_timer;
+
+    void disconnect_client(int client_fd);
+    void register_client(int client_fd, const struct sockaddr_storage& address);
+    void handle_new_connections();
+    void resume_accepting();
+    bool handle_read_from_client(int client_fd);
+    bool handle_write_to_client(int client_fd);
+    void set_reads_paused(int client_fd, bool paused);
+    void unwatch_client(int client_fd);
+    void resume_reads();
+    void flush_clients_with_new_messages();
+    void drain_wakeup_fd();
+
+    void check_rooms();
+    void submit_scores(int room);
+    void finish_game_if_scored(int room);
+    static void on_next_game_timer(TimerNode& node);
+    void start_next_game(int room);
+    static void on_leaderboard_timer(TimerNode& node);
+    void log_leaderboards();
+
+    void handle_closing_client(int client_fd, uint32_t events);
+    bool discard_input(int client_fd);
+    bool flush_closing_client(int client_fd);
+    void close_closing_client(int client_fd);
+};
+
+#endif // SERVER_SHARD_H
@@ -0,0 +1,24 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <cstdio>
+
+// Checks of the unit tests (make test). A failed check is reported and counted, and the
+// test goes on; approx-test exits with 1 if any check failed.
+extern int failed_checks;
+
+#define CHECK(condition)                                                                 \
+    do {                                                                                 \
+        if (!(condition)) {                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failed_checks++;                                                             \
+        }                                                                                \
+    } while (0)
+
+// Tests of the hot paths, one function per module.
+void test_server_events();
+void test_msg_parser();
+void test_line_framer();
+void test_server_logic();
+
+#endif // TEST_H
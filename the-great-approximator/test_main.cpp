@@ -0,0 +1,32 @@
+// Unit tests of the hot paths of the server. Rewrites of these paths are checked against
+// simple reference implementations and the edge cases of the protocol.
+
+#include <cstdio>
+
+#include "test.h"
+
+int failed_checks = 0;
+
+namespace {
+
+void run(const char* name, void (*test)()) {
+    int failed_before = failed_checks;
+    test();
+    printf("%-16s %s\n", name, failed_checks == failed_before ? "ok" : "FAILED");
+}
+
+} // namespace
+
+int main() {
+    run("server_events", test_server_events);
+    run("msg_parser", test_msg_parser);
+    run("line_framer", test_line_framer);
+    run("server_logic", test_server_logic);
+
+    if (failed_checks > 0) {
+        printf("%d checks failed.\n", failed_checks);
+        return 1;
+    }
+    printf("All tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "err.h"
+
+namespace {
+
+constexpr char trace_magic[8] = {'A', 'P', 'X', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t trace_version = 1;
+constexpr size_t record_header_size = 1 + 4 + 8 + 4;
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+template <typename T>
+void append_number(std::string& out, T value) {
+    out.append((const char*)&value, sizeof(value));
+}
+
+template <typename T>
+T read_number(const char* data) {
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+} // namespace
+
+TraceFile::TraceFile(const std::string& path, const std::string& command_line)
+    : fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+      start_ns(now_ns()),
+      connection_count(0),
+      write_mutex() {
+    if (fd < 0) {
+        syserr("could not create trace %s", path.c_str());
+    }
+    std::string header(trace_magic, sizeof(trace_magic));
+    append_number(header, trace_version);
+    append_number(header, (uint32_t)command_line.size());
+    header += command_line;
+    write(header);
+}
+
+TraceFile::~TraceFile() { close(fd); }
+
+void TraceFile::write(std::string_view chunk) {
+    std::scoped_lock<std::mutex> lock(write_mutex);
+    while (!chunk.empty()) {
+        ssize_t written = ::write(fd, chunk.data(), chunk.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syserr("could not write trace");
+        }
+        chunk.remove_prefix(written);
+    }
+}
+
+ShardTrace::ShardTrace(TraceFile& file) : file(file), buffer(), connection_of_fd() {}
+
+void ShardTrace::connect(int fd) {
+    if (fd >= (int)connection_of_fd.size()) {
+        connection_of_fd.resize(fd + 1);
+    }
+    connection_of_fd[fd] = file.next_connection();
+    add(TraceRecordType::CONNECT, fd, {});
+}
+
+void ShardTrace::line_in(int fd, std::string_view line) {
+    add(TraceRecordType::LINE_IN, fd, line);
+}
+
+void ShardTrace::message_out(int fd, std::string_view message) {
+    add(TraceRecordType::MESSAGE_OUT, fd, message);
+}
+
+void ShardTrace::disconnect(int fd) {
+    add(TraceRecordType::DISCONNECT, fd, {});
+}
+
+void ShardTrace::flush() {
+    if (!buffer.empty()) {
+        file.write(buffer);
+        buffer.clear();
+    }
+}
+
+void ShardTrace::add(TraceRecordType type, int fd, std::string_view data) {
+    append_number(buffer, (uint8_t)type);
+    append_number(buffer, connection_of_fd[fd]);
+    append_number(buffer, (uint64_t)(now_ns() - file.getStartTime()));
+    append_number(buffer, (uint32_t)data.size());
+    buffer.append(data);
+}
+
+void read_trace(const std::string& path, std::string& out_command_line,
+                std::vector<TraceRecord>& out_records) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        syserr("could not open trace %s", path.c_str());
+    }
+    std::string contents;
+    char chunk[64 * 1024];
+    size_t chunk_size;
+    while ((chunk_size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.append(chunk, chunk_size);
+    }
+    if (ferror(file)) {
+        syserr("could not read trace %s", path.c_str());
+    }
+    fclose(file);
+
+    const char* data = contents.data();
+    size_t size = contents.size();
+    size_t header_size = sizeof(trace_magic) + 4 + 4;
+    if (size < header_size || memcmp(data, trace_magic, sizeof(trace_magic)) != 0) {
+        fatal("%s is not a trace", path.c_str());
+    }
+    if (read_number<uint32_t>(data + sizeof(trace_magic)) != trace_version) {
+        fatal("trace %s has an unknown version", path.c_str());
+    }
+    uint32_t command_line_size = read_number<uint32_t>(data + sizeof(trace_magic) + 4);
+    if (size - header_size < command_line_size) {
+        fatal("trace %s is truncated", path.c_str());
+    }
+    out_command_line.assign(data + header_size, command_line_size);
+
+    // A record cut short by a server that was killed while writing is ignored.
+    out_records.clear();
+    size_t pos = header_size + command_line_size;
+    while (size - pos >= record_header_size) {
+        uint32_t length = read_number<uint32_t>(data + pos + 13);
+        if (size - pos - record_header_size < length) {
+            break;
+        }
+        TraceRecordType type = (TraceRecordType)data[pos];
+        if (type < TraceRecordType::CONNECT || type > TraceRecordType::DISCONNECT) {
+            fatal("trace %s is corrupted", path.c_str());
+        }
+        out_records.push_back({type, read_number<uint32_t>(data + pos + 1),
+                               read_number<uint64_t>(data + pos + 5),
+                               std::string(data + pos + record_header_size, length)});
+        pos += record_header_size + length;
+    }
+
+    std::stable_sort(out_records.begin(), out_records.end(),
+                     [](const TraceRecord& a, const TraceRecord& b) {
+                         return a.time_ns < b.time_ns;
+                     });
+}
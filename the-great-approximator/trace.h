@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Capture of the traffic of approx-server (--capture), replayed by approx-replay.
+// The file starts with the magic "APXTRACE", a version and the command line of the server,
+// followed by records of connections, lines received and messages queued for sending:
+//   type (1 byte), connection (4), time (8, nanoseconds since the capture started),
+//   length of data (4), data.
+// Numbers are in host byte order. Connections are numbered in the order they were
+// accepted, by all shards together. Every shard writes whole chunks of records, so the
+// records of different shards are not ordered by time in the file; read_trace() sorts them.
+
+enum class TraceRecordType : uint8_t {
+    CONNECT = 1,
+    LINE_IN = 2,     // a line received from the client, without CRLF
+    MESSAGE_OUT = 3, // a message queued for the client, with CRLF
+    DISCONNECT = 4,
+};
+
+struct TraceRecord {
+    TraceRecordType type;
+    uint32_t connection;
+    uint64_t time_ns;
+    std::string data;
+};
+
+// The trace file, shared by all shards.
+class TraceFile {
+ public:
+    // Creates the file, exits on error.
+    TraceFile(const std::string& path, const std::string& command_line);
+    ~TraceFile();
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    void write(std::string_view chunk);
+    uint32_t next_connection() { return connection_count.fetch_add(1); }
+    int64_t getStartTime() const { return start_ns; } // steady clock, nanoseconds
+
+ private:
+    int fd;
+    int64_t start_ns;
+    std::atomic<uint32_t> connection_count;
+    std::mutex write_mutex;
+};
+
+// Records of one shard, buffered by its thread and written by flush().
+class ShardTrace {
+ public:
+    explicit ShardTrace(TraceFile& file);
+    ~ShardTrace() { flush(); }
+    ShardTrace(const ShardTrace&) = delete;
+    ShardTrace& operator=(const ShardTrace&) = delete;
+
+    void connect(int fd);
+    void line_in(int fd, std::string_view line);
+    void message_out(int fd, std::string_view message);
+    void disconnect(int fd);
+
+    // Writes the buffered records to the file.
+    void flush();
+
+ private:
+    TraceFile& file;
+    std::string buffer;
+    std::vector<uint32_t> connection_of_fd;
+
+    void add(TraceRecordType type, int fd, std::string_view data);
+};
+
+// Reads a whole trace, sorted by time. Exits on error.
+void read_trace(const std::string& path, std::string& out_command_line,
+                std::vector<TraceRecord>& out_records);
+
+#endif // TRACE_H
@@ -0,0 +1,375 @@
+#include "trace_replayer.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "err.h"
+#include "networking.h"
+
+namespace {
+
+// Differing messages printed in full; the rest are only counted.
+constexpr uint64_t reported_differences = 5;
+
+} // namespace
+
+TraceReplayer::TraceReplayer(const ReplayArgParser& args)
+    : args(args),
+      server_addr(),
+      server_addr_len(0),
+      reactor(Reactor::create(ReactorBackend::EPOLL)),
+      command_line(),
+      events(),
+      next_event(0),
+      connection_count(0),
+      connections(),
+      connection_of_fd(),
+      expected_messages(0),
+      delivered_messages(0),
+      unfinished_connections(0),
+      recorded_ns(0),
+      last_progress(),
+      counters(),
+      latency(),
+      elapsed_seconds(0.0) {
+    resolve_server_address(args.getServerAddress(), std::to_string(args.getServerPort()),
+                           args.isIPv4Forced(), args.isIPv6Forced(), &server_addr,
+                           &server_addr_len);
+    load_trace();
+}
+
+// Splits the records into the events to replay and the messages expected on every
+// connection.
+void TraceReplayer::load_trace() {
+    std::vector<TraceRecord> records;
+    read_trace(args.getTraceFile(), command_line, records);
+
+    for (const TraceRecord& record : records) {
+        connection_count = std::max(connection_count, record.connection + 1);
+    }
+    connections = std::make_unique<Connection[]>(connection_count);
+    unfinished_connections = connection_count;
+
+    for (TraceRecord& record : records) {
+        Connection& connection = connections[record.connection];
+        recorded_ns = record.time_ns;
+        if (record.type == TraceRecordType::MESSAGE_OUT) {
+            std::string_view message = record.data;
+            if (message.size() >= constants::crlf.size() &&
+                message.substr(message.size() - constants::crlf.size()) == constants::crlf) {
+                record.data.resize(message.size() - constants::crlf.size());
+            }
+            connection.expected.push_back(std::move(record.data));
+            expected_messages++;
+            continue;
+        }
+        if (record.type == TraceRecordType::DISCONNECT) {
+            connection.close_recorded = true;
+        }
+        events.push_back({record.type, record.connection, record.time_ns, expected_messages,
+                          connection.expected.size(), std::move(record.data)});
+    }
+
+    for (uint32_t id = 0; id < connection_count; id++) {
+        check_finished(id); // nothing to wait for on connections never closed or answered
+    }
+}
+
+void TraceReplayer::run() {
+    Clock::time_point start = Clock::now();
+    last_progress = start;
+
+    while (true) {
+        Clock::time_point now = Clock::now();
+        // Connections are opened only here, so that events of a closed descriptor still
+        // waiting in the current batch are never taken for events of a new one.
+        while (next_event < events.size() && is_event_ready(events[next_event], start)) {
+            run_event(events[next_event++]);
+            last_progress = now;
+        }
+        if (next_event == events.size() && unfinished_connections == 0) {
+            break;
+        }
+
+        if (now - last_progress >= std::chrono::seconds(args.getIdleTimeout())) {
+            error("nothing happened for %d s, giving up", args.getIdleTimeout());
+            break;
+        }
+
+        for (const ReadyEvent& event : reactor->wait(wait_timeout(now, start))) {
+            handle_events(event.fd, event.events);
+        }
+    }
+
+    elapsed_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<int> fds = connection_of_fd.fds(); // copied, closing modifies it
+    for (int fd : fds) {
+        close_connection(connection_of_fd[fd]);
+    }
+}
+
+void TraceReplayer::print_report() const {
+    double seconds = elapsed_seconds > 0 ? elapsed_seconds : 1.0;
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+    uint64_t missing = expected_messages - delivered_messages;
+
+    printf("Replayed %zu of %zu events of %" PRIu32 " connections in %.2f s (recorded in %.2f "
+           "s, %s).\n",
+           next_event, events.size(), connection_count, elapsed_seconds, recorded_ns / 1e9,
+           args.isFast() ? "as fast as possible" : "at the recorded pace");
+    printf("Throughput: %.1f lines/s, %.1f messages/s (%" PRIu64 " lines, %" PRIu64
+           " messages).\n",
+           counters.lines / seconds, counters.messages / seconds, counters.lines,
+           counters.messages);
+    printf("Line->response latency: p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms, mean "
+           "%.3f ms.\n",
+           ms(latency.percentile(0.50)), ms(latency.percentile(0.99)),
+           ms(latency.percentile(0.999)), ms(latency.max()), latency.mean() / 1e6);
+    printf("Responses: %" PRIu64 " identical, %" PRIu64 " different, %" PRIu64
+           " missing, %" PRIu64 " unexpected; %" PRIu64 " lines not sent, %" PRIu64
+           " connect errors.\n",
+           counters.matched, counters.mismatched, missing, counters.unexpected,
+           counters.lines_dropped, counters.connect_errors);
+    printf("%s\n", is_identical() ? "Responses are identical." : "Responses differ.");
+}
+
+bool TraceReplayer::is_identical() const {
+    return counters.mismatched == 0 && counters.unexpected == 0 &&
+           delivered_messages == expected_messages && counters.connect_errors == 0;
+}
+
+// An event waits for the messages recorded before it and, at the recorded pace, for its
+// time.
+bool TraceReplayer::is_event_ready(const Event& event, Clock::time_point start) const {
+    if (delivered_messages < event.messages_before) {
+        return false;
+    }
+    return args.isFast() || Clock::now() >= start + std::chrono::nanoseconds(event.time_ns);
+}
+
+void TraceReplayer::run_event(const Event& event) {
+    Connection& connection = connections[event.connection];
+    switch (event.type) {
+        case TraceRecordType::CONNECT: open_connection(event.connection); break;
+        case TraceRecordType::LINE_IN:
+            if (connection.fd < 0) {
+                counters.lines_dropped++;
+                break;
+            }
+            connection.output.push(event.line + constants::crlf);
+            // A line gets no latency sample if nothing was recorded in response to it, or
+            // the message recorded after it has arrived already.
+            if (event.response_index < connection.expected.size() &&
+                event.response_index >= connection.received) {
+                connection.sent_lines.push_back({event.response_index, Clock::now()});
+            }
+            counters.lines++;
+            flush_output(event.connection);
+            break;
+        case TraceRecordType::DISCONNECT:
+            if (connection.fd >= 0) {
+                connection.shutdown_requested = true;
+                flush_output(event.connection);
+            }
+            break;
+        default: break;
+    }
+}
+
+void TraceReplayer::open_connection(uint32_t id) {
+    Connection& connection = connections[id];
+    int fd = start_connecting(&server_addr, server_addr_len);
+    if (fd < 0) {
+        if (counters.connect_errors++ == 0) {
+            error("could not connect to the server");
+        }
+        connection.closed = true;
+        check_finished(id);
+        return;
+    }
+
+    connection.fd = fd;
+    connection.connecting = true;
+    connection_of_fd.insert(fd) = id;
+    // Lines are sent once connected; the socket becomes writable then.
+    reactor->add(fd, true);
+}
+
+void TraceReplayer::close_connection(uint32_t id) {
+    Connection& connection = connections[id];
+    reactor->remove(connection.fd);
+    close(connection.fd);
+    connection_of_fd.erase(connection.fd);
+    connection.fd = -1;
+    connection.closed = true;
+    check_finished(id);
+}
+
+void TraceReplayer::handle_events(int fd, uint32_t events) {
+    if (!connection_of_fd.contains(fd)) {
+        return; // closed while handling an earlier event of this batch
+    }
+    uint32_t id = connection_of_fd[fd];
+    Connection& connection = connections[id];
+
+    if (connection.connecting) {
+        if (!(events & (reactor_events::writable | reactor_events::hangup |
+                        reactor_events::error))) {
+            return;
+        }
+        int socket_error = get_socket_error(fd);
+        if (socket_error != 0) {
+            errno = socket_error;
+            if (counters.connect_errors++ == 0) {
+                error("could not connect to the server");
+            }
+            close_connection(id);
+            return;
+        }
+        connection.connecting = false;
+    }
+
+    if (events & (reactor_events::readable | reactor_events::hangup | reactor_events::error)) {
+        if (!handle_read(id)) {
+            return;
+        }
+    }
+
+    if (events & reactor_events::writable) {
+        flush_output(id);
+    }
+}
+
+// Reads and handles messages until the socket is drained, the edge-triggered reactor reports
+// new input only once.
+// Returns whether the connection is still open.
+bool TraceReplayer::handle_read(uint32_t id) {
+    Connection& connection = connections[id];
+    while (true) {
+        char* free_space = connection.input.prepare();
+        ssize_t bytes_read = recv(connection.fd, free_space, connection.input.writable(), 0);
+
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = 0;
+                return true;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            errno = 0;
+        }
+        if (bytes_read <= 0) {
+            close_connection(id);
+            return false;
+        }
+
+        connection.input.commit(bytes_read);
+        std::string_view line;
+        while (connection.input.next_line(line)) {
+            handle_message(id, line);
+        }
+    }
+}
+
+// Returns whether the connection is still open.
+bool TraceReplayer::flush_output(uint32_t id) {
+    Connection& connection = connections[id];
+    if (connection.connecting || connection.write_shut_down) {
+        return true;
+    }
+
+    switch (connection.output.flush(connection.fd, SIZE_MAX)) {
+        case OutputQueue::FlushResult::DONE:
+            if (connection.shutdown_requested) {
+                shutdown(connection.fd, SHUT_WR);
+                connection.write_shut_down = true;
+            }
+            break;
+        case OutputQueue::FlushResult::BLOCKED:
+        case OutputQueue::FlushResult::BUDGET: break;
+        case OutputQueue::FlushResult::ERROR:
+            errno = 0; // the server closed the connection, reported by the next read
+            break;
+    }
+    return true;
+}
+
+// Compares the message with the one recorded at its position.
+void TraceReplayer::handle_message(uint32_t id, std::string_view line) {
+    Connection& connection = connections[id];
+    size_t index = connection.received++;
+    counters.messages++;
+    last_progress = Clock::now();
+
+    if (index >= connection.expected.size()) {
+        if (counters.unexpected++ < reported_differences) {
+            error("connection %" PRIu32 ", unexpected message %zu: %.*s", id, index,
+                  (int)line.size(), line.data());
+        }
+        return;
+    }
+
+    delivered_messages++;
+    const std::string& expected = connection.expected[index];
+    if (line == expected) {
+        counters.matched++;
+    } else if (counters.mismatched++ < reported_differences) {
+        error("connection %" PRIu32 ", message %zu: expected %s, got %.*s", id, index,
+              expected.c_str(), (int)line.size(), line.data());
+    }
+
+    while (!connection.sent_lines.empty() &&
+           connection.sent_lines.front().response_index <= index) {
+        if (connection.sent_lines.front().response_index == index) {
+            latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               last_progress - connection.sent_lines.front().time)
+                               .count());
+        }
+        connection.sent_lines.pop_front();
+    }
+    check_finished(id);
+}
+
+// A connection is finished when all its recorded messages have arrived and, if it was
+// closed in the trace, the server has closed it.
+void TraceReplayer::check_finished(uint32_t id) {
+    Connection& connection = connections[id];
+    if (connection.finished) {
+        return;
+    }
+    bool all_received = connection.received >= connection.expected.size();
+    if (connection.closed || (all_received && !connection.close_recorded)) {
+        connection.finished = true;
+        unfinished_connections--;
+    }
+}
+
+// Milliseconds until the next event is due at the recorded pace, or until the idle timeout.
+int TraceReplayer::wait_timeout(Clock::time_point now, Clock::time_point start) const {
+    Clock::duration timeout = last_progress + std::chrono::seconds(args.getIdleTimeout()) - now;
+    if (next_event < events.size() && delivered_messages >= events[next_event].messages_before) {
+        if (args.isFast()) {
+            return 0;
+        }
+        timeout = std::min(timeout, start + std::chrono::nanoseconds(events[next_event].time_ns) -
+                                        now);
+    }
+
+    if (timeout <= Clock::duration::zero()) {
+        return 0;
+    }
+    // Rounded up, so that the loop does not spin until the deadline.
+    return std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+}
@@ -0,0 +1,122 @@
+#ifndef TRACE_REPLAYER_H
+#define TRACE_REPLAYER_H
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "arg_parser.h"
+#include "fd_table.h"
+#include "latency_histogram.h"
+#include "line_framer.h"
+#include "output_queue.h"
+#include "reactor.h"
+#include "trace.h"
+
+// Plays the clients of a captured trace (approx-server --capture) against a server started
+// with the same command line and file, all over one epoll loop, and checks that the server
+// sends the same messages to every connection.
+// The recorded connections, lines and disconnections are replayed in the order of the trace.
+// Each of them waits until the messages the server had queued before it have been received,
+// so that the server sees the same sequence of events; at the recorded pace it is also not
+// sent earlier than its time in the trace. A disconnection shuts down the sending side and
+// the connection is closed once the server closes it too.
+class TraceReplayer {
+ public:
+    explicit TraceReplayer(const ReplayArgParser& args);
+    TraceReplayer(const TraceReplayer&) = delete;
+    TraceReplayer& operator=(const TraceReplayer&) = delete;
+
+    // Replays the whole trace, or until nothing happens for the idle timeout.
+    void run();
+
+    // Prints throughput, line->response latency and the result of the comparison.
+    void print_report() const;
+
+    // Whether every recorded message was received, and nothing else.
+    bool is_identical() const;
+
+    // Command line of the captured server.
+    const std::string& getCommandLine() const { return command_line; }
+
+ private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        TraceRecordType type; // CONNECT, LINE_IN or DISCONNECT
+        uint32_t connection;
+        uint64_t time_ns;
+        uint64_t messages_before; // recorded before this event, on all connections
+        size_t response_index;    // of the first message recorded after it on its connection
+        std::string line;
+    };
+
+    struct SentLine {
+        size_t response_index;
+        Clock::time_point time;
+    };
+
+    struct Connection {
+        int fd = -1;
+        bool connecting = false;
+        bool closed = false; // by the server, or it could not be opened
+        bool close_recorded = false;
+        bool shutdown_requested = false;
+        bool write_shut_down = false;
+        bool finished = false;
+        std::vector<std::string> expected; // recorded messages, without CRLF
+        size_t received = 0;
+        std::deque<SentLine> sent_lines; // waiting for their responses, in order
+        LineFramer input{0}; // no length limit, STATE lines grow with K
+        OutputQueue output;
+    };
+
+    struct Counters {
+        uint64_t lines = 0;
+        uint64_t lines_dropped = 0; // their connection was closed already
+        uint64_t messages = 0;
+        uint64_t matched = 0;
+        uint64_t mismatched = 0;
+        uint64_t unexpected = 0;
+        uint64_t connect_errors = 0;
+    };
+
+    const ReplayArgParser& args;
+    struct sockaddr_storage server_addr;
+    socklen_t server_addr_len;
+    std::unique_ptr<Reactor> reactor;
+    std::string command_line; // of the captured server
+    std::vector<Event> events;
+    size_t next_event;
+    uint32_t connection_count;
+    std::unique_ptr<Connection[]> connections; // indexed by the connection id of the trace
+    FdTable<uint32_t> connection_of_fd;
+    uint64_t expected_messages;
+    uint64_t delivered_messages; // received at the position of a recorded message
+    uint32_t unfinished_connections;
+    uint64_t recorded_ns;
+    Clock::time_point last_progress;
+    Counters counters;
+    LatencyHistogram latency;
+    double elapsed_seconds;
+
+    void load_trace();
+    void run_event(const Event& event);
+    void open_connection(uint32_t id);
+    void close_connection(uint32_t id);
+    void handle_events(int fd, uint32_t events);
+    bool handle_read(uint32_t id);
+    bool flush_output(uint32_t id);
+    void handle_message(uint32_t id, std::string_view line);
+    void check_finished(uint32_t id);
+    bool is_event_ready(const Event& event, Clock::time_point start) const;
+    int wait_timeout(Clock::time_point now, Clock::time_point start) const;
+};
+
+#endif // TRACE_REPLAYER_H